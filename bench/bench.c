@@ -0,0 +1,376 @@
+/*
+ * Benchmark runner for the interpreter.
+ *
+ * Runs each workload in a fresh interpreter process a number of times and
+ * prints one JSON object per workload with the min, median and p99 wall
+ * time, the peak resident set size and the number of lvals allocated.
+ *
+ * Build and run from the repository root:
+ *
+ *     cc -O2 -o bench/bench bench/bench.c
+ *     bench/bench [-n runs] [-l interpreter] [-t threads,...] [-s socket] [workload.dlsp ...]
+ *
+ * With no workloads given every .dlsp file in bench/ is run. A run fails if the
+ * interpreter exits abnormally or prints an error. With -t each workload is run
+ * once per listed thread count, passed to the interpreter as LISPY_THREADS.
+ * With -s each workload is sent to a running `lispy --serve` on that socket
+ * instead, which times the request alone; RSS and allocations aren't reported.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#define LARGE_FILE "bench/large.gen.dlsp"
+#define LARGE_BINARY "bench/large.gen.bin"
+#define LARGE_ROWS 5000
+
+typedef struct {
+    double ms;
+    long rssKb;
+    long allocs;
+    int ok;
+} run_result;
+
+void write_rows(FILE* out) {
+    for(int i = 0; i < LARGE_ROWS; i++) {
+        fprintf(out, "{%i \"row %i\" {name value-%i} {%i %i %i} ; comment\n  {nested {deeper %i}}}\n",
+            i, i, i, i * 3, i * 5, i * 7, i);
+    }
+}
+
+/* Write the data file for the parse workload if it isn't there yet */
+void generate_large_file(void) {
+    struct stat st;
+
+    if(stat(LARGE_FILE, &st) == 0)
+        return;
+
+    FILE* out = fopen(LARGE_FILE, "w");
+
+    if(!out) {
+        perror(LARGE_FILE);
+        exit(1);
+    }
+
+    fprintf(out, ";;; Generated by bench/bench.c\n");
+    write_rows(out);
+    fclose(out);
+}
+
+/* The same rows as one list in the interpreter's binary format, for the
+ * deserialize workload, written by having the interpreter serialize them */
+void generate_large_binary(char* lispy) {
+    struct stat st;
+    char* script = "bench/large.gen.ser.dlsp";
+
+    if(stat(LARGE_BINARY, &st) == 0)
+        return;
+
+    FILE* out = fopen(script, "w");
+
+    if(!out) {
+        perror(script);
+        exit(1);
+    }
+
+    fprintf(out, ";;; Generated by bench/bench.c\n(serialize {\n");
+    write_rows(out);
+    fprintf(out, "} \"%s\")\n", LARGE_BINARY);
+    fclose(out);
+
+    pid_t pid = fork();
+
+    if(pid == 0) {
+        int null = open("/dev/null", O_RDWR);
+        dup2(null, 0);
+        dup2(null, 1);
+
+        execl(lispy, lispy, script, (char*)NULL);
+        perror(lispy);
+        _exit(127);
+    }
+
+    waitpid(pid, NULL, 0);
+    unlink(script);
+
+    if(stat(LARGE_BINARY, &st) != 0)
+        fprintf(stderr, "%s: could not generate %s\n", lispy, LARGE_BINARY);
+}
+
+/* Run the interpreter once over a workload */
+run_result run_once(char* lispy, char* workload) {
+    run_result result = { 0, 0, -1, 0 };
+    int fds[2];
+
+    if(pipe(fds) != 0) {
+        perror("pipe");
+        exit(1);
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pid_t pid = fork();
+
+    if(pid == 0) {
+        /* No input so the REPL exits once the workload is loaded */
+        int null = open("/dev/null", O_RDONLY);
+        dup2(null, 0);
+        dup2(fds[1], 1);
+        dup2(fds[1], 2);
+        close(fds[0]);
+
+        execl(lispy, lispy, "--stats", workload, (char*)NULL);
+        perror(lispy);
+        _exit(127);
+    }
+
+    close(fds[1]);
+
+    /* Collect the output, looking for errors and the allocation count */
+    FILE* in = fdopen(fds[0], "r");
+    char* line = NULL;
+    size_t cap = 0;
+    int errors = 0;
+
+    while(getline(&line, &cap, in) != -1) {
+        if(strstr(line, "Error:"))
+            errors++;
+
+        /* Total allocations from the --stats report */
+        sscanf(line, " total %li", &result.allocs);
+    }
+
+    free(line);
+    fclose(in);
+
+    int status;
+    struct rusage usage;
+    wait4(pid, &status, 0, &usage);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    result.ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+    result.rssKb = usage.ru_maxrss;
+    result.ok = WIFEXITED(status) && WEXITSTATUS(status) == 0 && errors == 0;
+
+    return result;
+}
+
+/* Send a workload to a server and read back its output */
+run_result run_socket(char* socketPath, char* workload) {
+    run_result result = { 0, 0, -1, 0 };
+
+    FILE* file = fopen(workload, "r");
+
+    if(!file) {
+        perror(workload);
+        exit(1);
+    }
+
+    char* script = NULL;
+    size_t size = 0;
+    FILE* buf = open_memstream(&script, &size);
+    char chunk[4096];
+    size_t n;
+
+    while((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        fwrite(chunk, 1, n, buf);
+    }
+
+    fclose(buf);
+    fclose(file);
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socketPath, sizeof(addr.sun_path) - 1);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if(fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        perror(socketPath);
+        exit(1);
+    }
+
+    for(size_t sent = 0; sent < size; ) {
+        ssize_t w = write(fd, script + sent, size - sent);
+
+        if(w <= 0)
+            break;
+
+        sent += w;
+    }
+
+    shutdown(fd, SHUT_WR);
+
+    /* Collect the output, looking for errors */
+    FILE* in = fdopen(fd, "r");
+    char* line = NULL;
+    size_t cap = 0;
+    int errors = 0;
+
+    while(getline(&line, &cap, in) != -1) {
+        if(strstr(line, "Error:") || strstr(line, "error:"))
+            errors++;
+    }
+
+    free(line);
+    fclose(in);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    result.ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+    result.ok = errors == 0;
+
+    free(script);
+
+    return result;
+}
+
+int cmp_double(const void* a, const void* b) {
+    double x = *(double*)a;
+    double y = *(double*)b;
+
+    return (x > y) - (x < y);
+}
+
+void bench(char* lispy, char* socketPath, char* workload, int runs, char* threads) {
+    double* times = malloc(sizeof(double) * runs);
+    long rssKb = 0;
+    long allocs = -1;
+    int ok = 1;
+
+    for(int i = 0; i < runs; i++) {
+        run_result r = socketPath ? run_socket(socketPath, workload) : run_once(lispy, workload);
+
+        times[i] = r.ms;
+        ok = ok && r.ok;
+        allocs = r.allocs;
+
+        if(r.rssKb > rssKb)
+            rssKb = r.rssKb;
+    }
+
+    qsort(times, runs, sizeof(double), cmp_double);
+
+    /* Nearest rank percentiles */
+    double median = times[(runs - 1) / 2];
+    int p99 = (runs * 99 + 99) / 100 - 1;
+
+    printf("{\"workload\": \"%s\", ", workload);
+
+    if(threads)
+        printf("\"threads\": %s, ", threads);
+
+    printf("\"runs\": %i, \"ok\": %s, \"min_ms\": %.3f, \"median_ms\": %.3f, "
+           "\"p99_ms\": %.3f, \"max_rss_kb\": %li, \"allocs\": %li}\n",
+        runs, ok ? "true" : "false", times[0], median, times[p99], rssKb, allocs);
+    fflush(stdout);
+
+    free(times);
+}
+
+int cmp_str(const void* a, const void* b) {
+    return strcmp(*(char**)a, *(char**)b);
+}
+
+/* Every .dlsp file in bench/ other than generated data, in name order */
+int find_workloads(char*** out) {
+    DIR* dir = opendir("bench");
+    struct dirent* entry;
+    char** names = NULL;
+    int count = 0;
+
+    if(!dir) {
+        perror("bench");
+        exit(1);
+    }
+
+    while((entry = readdir(dir))) {
+        size_t len = strlen(entry->d_name);
+
+        if(len < 5 || strcmp(entry->d_name + len - 5, ".dlsp") != 0)
+            continue;
+
+        if(strstr(entry->d_name, ".gen."))
+            continue;
+
+        names = realloc(names, sizeof(char*) * (count + 1));
+        names[count] = malloc(len + 7);
+        sprintf(names[count++], "bench/%s", entry->d_name);
+    }
+
+    closedir(dir);
+    qsort(names, count, sizeof(char*), cmp_str);
+
+    *out = names;
+    return count;
+}
+
+int main(int argc, char** argv) {
+    char* lispy = "./lispy";
+    char* threads = NULL;
+    char* socketPath = NULL;
+    int runs = 10;
+    int opt;
+
+    while((opt = getopt(argc, argv, "n:l:t:s:")) != -1) {
+        switch(opt) {
+            case 'n': runs = atoi(optarg); break;
+            case 'l': lispy = optarg; break;
+            case 't': threads = optarg; break;
+            case 's': socketPath = optarg; break;
+
+            default:
+                fprintf(stderr, "Usage: %s [-n runs] [-l interpreter] [-t threads,...] [-s socket] [workload.dlsp ...]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if(runs < 1)
+        runs = 1;
+
+    generate_large_file();
+    generate_large_binary(lispy);
+
+    char** workloads = argv + optind;
+    int count = argc - optind;
+
+    if(count == 0)
+        count = find_workloads(&workloads);
+
+    for(int i = 0; i < count; i++) {
+        if(!threads) {
+            bench(lispy, socketPath, workloads[i], runs, NULL);
+            continue;
+        }
+
+        /* One line per thread count, each run with LISPY_THREADS set */
+        char* list = strdup(threads);
+
+        for(char* count = strtok(list, ","); count; count = strtok(NULL, ",")) {
+            setenv("LISPY_THREADS", count, 1);
+            bench(lispy, socketPath, workloads[i], runs, count);
+        }
+
+        unsetenv("LISPY_THREADS");
+        free(list);
+    }
+
+    return 0;
+}
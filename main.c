@@ -1,6 +1,26 @@
+//rwlocks, sigaction, getline, madvise and clock_gettime are POSIX/BSD
+//extensions that strict -std=c99 hides unless asked for
+#define _DEFAULT_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <limits.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <errno.h>
+
+#ifndef _WIN32
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#endif
 
 #include "mpc.h"
 
@@ -32,8 +52,9 @@ void add_history(char* unused) {}
 
 #define LASSERT(args, cond, fmt, ...) \
     if (!(cond)) { \
+        lval* err = lval_err(fmt, ##__VA_ARGS__); \
         lval_del(args); \
-        return lval_err(fmt, ##__VA_ARGS__); \
+        return err; \
     }
 
 #define LASSERT_TYPE(func, args, index, expect) \
@@ -46,6 +67,10 @@ void add_history(char* unused) {}
     "Function '%s' passed incorrect number of arguments. Got %i, Expected %i.", \
     func, args->count, num)
 
+//Reference counts on values that threads share
+#define LREF_INC(refs) __atomic_add_fetch(&(refs), 1, __ATOMIC_RELAXED)
+#define LREF_DEC(refs) __atomic_sub_fetch(&(refs), 1, __ATOMIC_ACQ_REL)
+
 #define LASSERT_NOT_EMPTY(func, args, index) \
   LASSERT(args, args->cell[index]->count != 0, \
     "Function '%s' passed {} for argument %i.", func, index);
@@ -53,8 +78,32 @@ void add_history(char* unused) {}
 /* Forward definers */
     struct lval;
     struct lenv;
+    struct lhash;
+    struct lhamt;
+    struct lbuf;
+    struct lsink;
+    struct lsite;
+    struct lmemo;
+    struct lthread;
+    struct lfuture;
+    struct lisolate;
+    struct lseq;
+    struct lfile;
+    struct lname;
     typedef struct lval lval;
     typedef struct lenv lenv;
+    typedef struct lhash lhash;
+    typedef struct lhamt lhamt;
+    typedef struct lbuf lbuf;
+    typedef struct lsink lsink;
+    typedef struct lsite lsite;
+    typedef struct lmemo lmemo;
+    typedef struct lthread lthread;
+    typedef struct lfuture lfuture;
+    typedef struct lisolate lisolate;
+    typedef struct lseq lseq;
+    typedef struct lfile lfile;
+    typedef struct lname lname;
 
     typedef lval*(*lbuiltin)(lenv*, lval*);
     void lval_print(lval* val);
@@ -62,9 +111,37 @@ void add_history(char* unused) {}
     lval* lval_cpy(lval* vals);
     lval* lval_err(char* fmt, ...);
     lval* lval_eval_sexpr(lenv* env, lval* val);
+    lval* lval_eval_ref(lenv* env, lval* expr);
+    lval* lval_eval_sexpr_ref(lenv* env, lval* expr);
     char* ltype_name(int type);
-    void lval_print_str(lval* val);
+    void lval_sink(lsink* sink, lval* val);
     void lval_println(lval* val);
+    int lval_eq(lval* x, lval* y);
+    void lhash_del(lhash* table);
+    lhash* lhash_cpy(lhash* table);
+    lhash* lhash_own(lval* map);
+    lhash* lhash_new(int cap);
+    int lhash_find(lhash* table, lval* key, unsigned long hash);
+    void lhamt_release(lhamt* node);
+    lval* lhamt_get(lhamt* node, unsigned long hash, lval* key);
+    void lmemo_release(lmemo* memo);
+    lval* lmemo_call(lenv* env, lval* func, lval* args);
+    lval* lval_call(lenv* env, lval* func, lval* args);
+    void lthread_release(lthread* thread);
+    void lfuture_release(lfuture* future);
+    void lisolate_retain(lisolate* iso);
+    void lisolate_release(lisolate* iso);
+    void lseq_release(lseq* seq);
+    void lfile_release(lfile* file);
+    unsigned long lhash_bytes(char* bytes, long len);
+    lval* lval_lambda(lval* formals, lval* body);
+    lval* builtin_load(lenv* env, lval* args);
+    void lenv_add_builtins(lenv* env);
+    lval* builtin_join_thread(lenv* env, lval* args);
+    lval* lopt_body(lenv* env, lval* body);
+    lval* lopt_redefine(lenv* env, lval* sym, lval* val);
+    int lopt_reserved(lval* sym);
+    void lopt_reserve(char* name);
 
     mpc_parser_t* Number;
     mpc_parser_t* Symbol;
@@ -83,29 +160,181 @@ void add_history(char* unused) {}
         /* Basic */
         long num;
 
-        //Error and Symbol types store string data
+        //Error and Symbol types store NUL terminated string data
         char* err;
         char* symbol;
+
+        //Interned record a symbol's data belongs to
+        lname* name;
+
+        /* String - a slice of a shared buffer, not NUL terminated */
         char* str;
+        lbuf* buf;
+
+        //Length in bytes of the err, symbol or str data
+        long len;
 
         /* Function */
         lbuiltin builtin;
         lenv* env;
         lval* formals;
         lval* body;
+        lsite* site;
+
+        //Shared result cache if wrapped by memo
+        lmemo* memo;
 
         /* Expression */
         int count;
         struct lval** cell;
+
+        //Where the expression was read from, for profiling
+        char* file;
+        int line;
+
+        /* Vector - packed numbers, length stored in count */
+        long* data;
+
+        /* Hash Map */
+        lhash* hash;
+
+        /* Dict - persistent map, entry count stored in count */
+        lhamt* dict;
+
+        /* Thread */
+        lthread* thread;
+
+        /* Future */
+        lfuture* future;
+
+        /* Isolate */
+        lisolate* isolate;
+
+        /* Lazy Sequence */
+        lseq* seq;
+
+        /* File */
+        lfile* stream;
     } lval;
 
     struct lenv {
         lenv* parent;
+
+        //Global env at the end of the parent chain
+        lenv* root;
+
+        //Set on a global env, which threads share
+        pthread_rwlock_t* lock;
+
+        //Changes whenever a global env is defined into, see lname
+        unsigned long long version;
+
         int count;
         char** symbols;
+        long* lens;
+        lval** vals;
+    };
+
+    //Every symbol with the same name shares one of these, so lookups can
+    //remember where the name was found. cache packs the version of the
+    //global env it was found in above the slot it was found at. Versions
+    //come from one counter for all global envs, so a match means the same
+    //env, unchanged since. local is set once the name is bound anywhere
+    //but a global env, after which lookups walk the whole chain again.
+    //pinned is set on the names --optimize may build values in from.
+    struct lname {
+        lname* next;
+        unsigned long hash;
+        int local;
+        int pinned;
+        unsigned long long cache;
+        long len;
+        char symbol[];
+    };
+
+    //Hash tables use open addressing with linear probing. cap is a power of
+    //two and empty slots have a NULL key. Copies of a map share its table,
+    //with refs counting them, until one of them changes it.
+    struct lhash {
+        int refs;
+        int count;
+        int cap;
+        unsigned long* hashes;
+        lval** keys;
+        lval** vals;
+    };
+
+    //Storage shared by string values. A string is a slice of a buffer, so
+    //copies and substrings just take a reference. Bytes past used are free,
+    //which lets an append to the slice that ends at used write in place.
+    struct lbuf {
+        int refs;
+        long cap;
+        long used;
+        char data[];
+    };
+
+    //Where the printer writes. Bytes collect in data and go to out when it
+    //fills, or data grows when there is no out.
+    struct lsink {
+        char* data;
+        long len;
+        long cap;
+        FILE* out;
+    };
+
+    #define LSINK_SIZE 4096
+
+    //Nodes of a hash array mapped trie. A branch uses 5 bits of the key hash
+    //per level to pick among up to 32 children, stored densely and indexed
+    //by popcount of bitmap. A leaf holds the entries for one full hash,
+    //usually just one. Nodes never change once built and are shared between
+    //dicts, with refs counting the dicts and parent nodes that hold them.
+    struct lhamt {
+        int refs;
+        int leaf;
+        int count;
+
+        /* Branch */
+        unsigned int bitmap;
+        lhamt** children;
+
+        /* Leaf */
+        unsigned long hash;
+        lval** keys;
         lval** vals;
     };
 
+    //A place lambdas are created from, named by the first def that binds
+    //one. The profiler keeps its counters here.
+    struct lsite {
+        char* name;
+        char* file;
+        int line;
+
+        long calls;
+        long allocs;
+        long selfSamples;
+        long totalSamples;
+        long mark;
+
+        lsite* next;
+    };
+
+    //A thread started by spawn. The handle values and the running thread
+    //each hold a reference; result is set once done.
+    struct lthread {
+        int refs;
+        pthread_mutex_t lock;
+        pthread_cond_t finished;
+        int done;
+
+        lenv* env;
+        lval* func;
+        lval* args;
+        lval* result;
+    };
+
     //LVAL types
 
     enum {
@@ -115,884 +344,6371 @@ void add_history(char* unused) {}
         LVAL_QEXPR,
         LVAL_ERR,
         LVAL_FUN,
-        LVAL_STR
+        LVAL_STR,
+        LVAL_VEC,
+        LVAL_HASH,
+        LVAL_DICT,
+        LVAL_THREAD,
+        LVAL_FUTURE,
+        LVAL_ISOLATE,
+        LVAL_SEQ,
+        LVAL_FILE,
+
+        //Number of types, keep last
+        LVAL_TYPE_COUNT
     };
 
-/* Functions */
-    //Recursively counts the total number of nodes in our Abstract Syntax Tree
-    int number_of_nodes(mpc_ast_t* tree) {
-        if(tree->children_num == 0)
-            return 1;
-
-        if(tree->children_num >= 1) {
-            int total = 1;
-
-            for(int i = 0; i < tree->children_num; i++) {
-                total += number_of_nodes(tree->children[i]);
-            }
+/* SIMD Kernels */
+    //Packed vector kernels. Each has a portable scalar version and, on x86-64,
+    //SSE/AVX2 versions which lvec_init selects once based on the running CPU.
+    //Arithmetic goes through unsigned long so overflow wraps like builtin_op.
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(_WIN32)
+#define LVEC_SIMD
+#include <immintrin.h>
+#endif
 
-            return total;
-        }
+    typedef struct {
+        void (*add)(long* out, long* x, long* y, int n);
+        void (*sub)(long* out, long* x, long* y, int n);
+        long (*sum)(long* x, int n);
+        long (*min)(long* x, int n);
+        long (*max)(long* x, int n);
+        long (*dot)(long* x, long* y, int n);
+    } lvec_kernels;
+
+    void lvec_add_scalar(long* out, long* x, long* y, int n) {
+        for(int i = 0; i < n; i++)
+            out[i] = (unsigned long)x[i] + (unsigned long)y[i];
+    }
 
-        return 0;
+    void lvec_sub_scalar(long* out, long* x, long* y, int n) {
+        for(int i = 0; i < n; i++)
+            out[i] = (unsigned long)x[i] - (unsigned long)y[i];
     }
 
-/* Constructor/Destructor functions */
-    //Create a new environment
-    lenv* lenv_new(void) {
-        lenv* env = malloc(sizeof(lenv));
+    long lvec_sum_scalar(long* x, int n) {
+        unsigned long total = 0;
 
-        env->parent = NULL;
-        env->count = 0;
-        env->symbols = NULL;
-        env->vals = NULL;
+        for(int i = 0; i < n; i++)
+            total += x[i];
 
-        return env;
+        return total;
     }
 
-    void lenv_del(lenv* env) {
-        for(int i = 0; i < env->count; i++) {
-            free(env->symbols[i]);
-            lval_del(env->vals[i]);
-        }
+    long lvec_min_scalar(long* x, int n) {
+        long result = x[0];
 
-        free(env->symbols);
-        free(env->vals);
-        free(env);
+        for(int i = 1; i < n; i++)
+            if(x[i] < result) result = x[i];
+
+        return result;
     }
 
-    lval* lenv_get(lenv* env, lval* val) {
-        //Iterate over all items in env
-        for(int i = 0; i < env->count; i++) {
-            //Check if the stored string matches the symbol string
-            //If it does, return a copy of the value
-            if(strcmp(env->symbols[i], val->symbol) == 0) {
-                return lval_cpy(env->vals[i]);
-            }
-        }
+    long lvec_max_scalar(long* x, int n) {
+        long result = x[0];
 
-        //If no symbol found check parent/return err
-        if(env->parent) {
-            return lenv_get(env->parent, val);
-        } else {
-            return lval_err("Unbound Symbol: '%s'", val->symbol);
-        }
+        for(int i = 1; i < n; i++)
+            if(x[i] > result) result = x[i];
+
+        return result;
     }
 
-    void lenv_set(lenv* env, lval* k, lval* v) {
-        //Iterate over all items in env to check if variable exists
-        for(int i = 0; i < env->count; i++) {
-            //If var is found delete item at that pos and replace
-            if(strcmp(env->symbols[i], k->symbol) == 0) {
-                lval_del(env->vals[i]);
-                env->vals[i] = lval_cpy(v);
-                return;
-            }
-        }
+    long lvec_dot_scalar(long* x, long* y, int n) {
+        unsigned long total = 0;
 
-        //If no existing entry found, allocate space for new entry
-        env->count++;
-        env->vals = realloc(env->vals, sizeof(lval*) * env->count);
-        env->symbols = realloc(env->symbols, sizeof(char*) * env->count);
+        for(int i = 0; i < n; i++)
+            total += (unsigned long)x[i] * (unsigned long)y[i];
 
-        //Copy contents of lval and symbol string into new location
-        env->vals[env->count - 1] = lval_cpy(v);
-        env->symbols[env->count - 1] = malloc(strlen(k->symbol));
-        strcpy(env->symbols[env->count - 1], k->symbol);
+        return total;
     }
 
-    //Copies an environment
-    lenv* lenv_cpy(lenv* env) {
-        lenv* cpy = malloc(sizeof(lenv));
-
-        cpy->parent = env->parent;
-        cpy->count = env->count;
-        cpy->symbols = malloc(sizeof(char*) * cpy->count);
-        cpy->vals = malloc(sizeof(lval*) * cpy->count);
+#ifdef LVEC_SIMD
+    //SSE2 is part of the x86-64 baseline so needs no target attribute
+    void lvec_add_sse2(long* out, long* x, long* y, int n) {
+        int i = 0;
 
-        for(int i = 0; i < env->count; i++) {
-            cpy->symbols[i] = malloc(strlen(env->symbols[i]) + 1);
-            strcpy(cpy->symbols[i], env->symbols[i]);
-            cpy->vals[i] = lval_cpy(env->vals[i]);
+        for(; i + 2 <= n; i += 2) {
+            __m128i a = _mm_loadu_si128((__m128i*)(x + i));
+            __m128i b = _mm_loadu_si128((__m128i*)(y + i));
+            _mm_storeu_si128((__m128i*)(out + i), _mm_add_epi64(a, b));
         }
 
-        return cpy;
+        lvec_add_scalar(out + i, x + i, y + i, n - i);
     }
 
-    //Defines a variable in the global env
-    void lenv_def(lenv* env, lval* key, lval* val) {
-        //Iterate til env has no parent
-        while(env->parent) {
-            env = env->parent;
+    void lvec_sub_sse2(long* out, long* x, long* y, int n) {
+        int i = 0;
+
+        for(; i + 2 <= n; i += 2) {
+            __m128i a = _mm_loadu_si128((__m128i*)(x + i));
+            __m128i b = _mm_loadu_si128((__m128i*)(y + i));
+            _mm_storeu_si128((__m128i*)(out + i), _mm_sub_epi64(a, b));
         }
 
-        //Put value in e
-        lenv_set(env, key, val);
+        lvec_sub_scalar(out + i, x + i, y + i, n - i);
     }
 
-    //Create a new number type lval
-    lval* lval_num(long x) {
-        lval* val = malloc(sizeof(lval));
+    long lvec_sum_sse2(long* x, int n) {
+        __m128i acc = _mm_setzero_si128();
+        long lanes[2];
+        int i = 0;
 
-        val->type = LVAL_NUM;
-        val->num = x;
+        for(; i + 2 <= n; i += 2)
+            acc = _mm_add_epi64(acc, _mm_loadu_si128((__m128i*)(x + i)));
 
-        return val;
+        _mm_storeu_si128((__m128i*)lanes, acc);
+
+        return (unsigned long)lanes[0] + lanes[1] + lvec_sum_scalar(x + i, n - i);
     }
 
-    //Create a new symbol type lval
-    lval* lval_sym(char* sym) {
-        lval* val = malloc(sizeof(lval));
+    //64-bit compares arrived with SSE4.2
+    __attribute__((target("sse4.2")))
+    long lvec_min_sse42(long* x, int n) {
+        if(n < 2)
+            return lvec_min_scalar(x, n);
 
-        val->type = LVAL_SYM;
-        val->symbol = malloc(strlen(sym) + 1);
+        __m128i acc = _mm_loadu_si128((__m128i*)x);
+        long lanes[2];
+        int i = 2;
 
-        strcpy(val->symbol, sym);
+        for(; i + 2 <= n; i += 2) {
+            __m128i v = _mm_loadu_si128((__m128i*)(x + i));
+            acc = _mm_blendv_epi8(acc, v, _mm_cmpgt_epi64(acc, v));
+        }
 
-        return val;
+        _mm_storeu_si128((__m128i*)lanes, acc);
+
+        long result = lanes[0] < lanes[1] ? lanes[0] : lanes[1];
+        for(; i < n; i++)
+            if(x[i] < result) result = x[i];
+
+        return result;
     }
 
-    //Create a new s-expr type lval
-    lval* lval_sexpr(void) {
-        lval* val = malloc(sizeof(lval));
+    __attribute__((target("sse4.2")))
+    long lvec_max_sse42(long* x, int n) {
+        if(n < 2)
+            return lvec_max_scalar(x, n);
 
-        val->type = LVAL_SEXPR;
-        val->count = 0;
-        val->cell = NULL;
+        __m128i acc = _mm_loadu_si128((__m128i*)x);
+        long lanes[2];
+        int i = 2;
 
-        return val;
+        for(; i + 2 <= n; i += 2) {
+            __m128i v = _mm_loadu_si128((__m128i*)(x + i));
+            acc = _mm_blendv_epi8(acc, v, _mm_cmpgt_epi64(v, acc));
+        }
+
+        _mm_storeu_si128((__m128i*)lanes, acc);
+
+        long result = lanes[0] > lanes[1] ? lanes[0] : lanes[1];
+        for(; i < n; i++)
+            if(x[i] > result) result = x[i];
+
+        return result;
     }
 
-    //Create a new q-expr type lval
-    lval* lval_qexpr(void) {
-        lval* val = malloc(sizeof(lval));
+    __attribute__((target("avx2")))
+    void lvec_add_avx2(long* out, long* x, long* y, int n) {
+        int i = 0;
 
-        val->type = LVAL_QEXPR;
-        val->count = 0;
-        val->cell = NULL;
+        for(; i + 4 <= n; i += 4) {
+            __m256i a = _mm256_loadu_si256((__m256i*)(x + i));
+            __m256i b = _mm256_loadu_si256((__m256i*)(y + i));
+            _mm256_storeu_si256((__m256i*)(out + i), _mm256_add_epi64(a, b));
+        }
 
-        return val;
+        lvec_add_scalar(out + i, x + i, y + i, n - i);
     }
 
-    //Create a new function type lval
-    lval* lval_fun(lbuiltin func) {
-        lval* vals = malloc(sizeof(lval));
+    __attribute__((target("avx2")))
+    void lvec_sub_avx2(long* out, long* x, long* y, int n) {
+        int i = 0;
 
-        vals->type = LVAL_FUN;
-        vals->builtin = func;
+        for(; i + 4 <= n; i += 4) {
+            __m256i a = _mm256_loadu_si256((__m256i*)(x + i));
+            __m256i b = _mm256_loadu_si256((__m256i*)(y + i));
+            _mm256_storeu_si256((__m256i*)(out + i), _mm256_sub_epi64(a, b));
+        }
 
-        return vals;
+        lvec_sub_scalar(out + i, x + i, y + i, n - i);
     }
 
-    //Create a new string type lval
-    lval* lval_str(char* str) {
-        lval* val = malloc(sizeof(lval));
+    __attribute__((target("avx2")))
+    long lvec_sum_avx2(long* x, int n) {
+        __m256i acc = _mm256_setzero_si256();
+        long lanes[4];
+        int i = 0;
 
-        val->type = LVAL_STR;
-        val->str = malloc(strlen(str) + 1);
-        strcpy(val->str, str);
+        for(; i + 4 <= n; i += 4)
+            acc = _mm256_add_epi64(acc, _mm256_loadu_si256((__m256i*)(x + i)));
 
-        return val;
+        _mm256_storeu_si256((__m256i*)lanes, acc);
+
+        return (unsigned long)lanes[0] + lanes[1] + lanes[2] + lanes[3] + lvec_sum_scalar(x + i, n - i);
     }
 
-    lval* lval_lambda(lval* formals, lval* body) {
-        lval* result = malloc(sizeof(lval));
+    __attribute__((target("avx2")))
+    long lvec_min_avx2(long* x, int n) {
+        if(n < 4)
+            return lvec_min_scalar(x, n);
 
-        result->type = LVAL_FUN;
+        __m256i acc = _mm256_loadu_si256((__m256i*)x);
+        long lanes[4];
+        int i = 4;
 
-        //Set builtin to NULL
-        result->builtin = NULL;
+        for(; i + 4 <= n; i += 4) {
+            __m256i v = _mm256_loadu_si256((__m256i*)(x + i));
+            acc = _mm256_blendv_epi8(acc, v, _mm256_cmpgt_epi64(acc, v));
+        }
 
-        //Build new environment
-        result->env = lenv_new();
+        _mm256_storeu_si256((__m256i*)lanes, acc);
 
-        //Set formals and body
-        result->formals = formals;
-        result->body = body;
+        long result = lvec_min_scalar(lanes, 4);
+        for(; i < n; i++)
+            if(x[i] < result) result = x[i];
 
         return result;
     }
 
-    //Create a new error type lval
-    lval* lval_err(char* fmt, ...) {
+    __attribute__((target("avx2")))
+    long lvec_max_avx2(long* x, int n) {
+        if(n < 4)
+            return lvec_max_scalar(x, n);
 
-        lval* val = malloc(sizeof(lval));
-        val->type = LVAL_ERR;
+        __m256i acc = _mm256_loadu_si256((__m256i*)x);
+        long lanes[4];
+        int i = 4;
 
-        //Create va list and initialize it
-        va_list va;
-        va_start(va, fmt);
+        for(; i + 4 <= n; i += 4) {
+            __m256i v = _mm256_loadu_si256((__m256i*)(x + i));
+            acc = _mm256_blendv_epi8(acc, v, _mm256_cmpgt_epi64(v, acc));
+        }
 
-        val->err = malloc(512);
+        _mm256_storeu_si256((__m256i*)lanes, acc);
 
-        //printf the error with the string w/ max of 511 chars
-        vsnprintf(val->err, 511, fmt, va);
+        long result = lvec_max_scalar(lanes, 4);
+        for(; i < n; i++)
+            if(x[i] > result) result = x[i];
 
-        //Reallocate to numer of bytes actually used
-        val->err = realloc(val->err, strlen(val->err) + 1);
+        return result;
+    }
 
-        //clean up the va list
-        va_end(va);
+    //AVX2 has no 64-bit multiply, so build it from three 32x32->64 products
+    __attribute__((target("avx2")))
+    long lvec_dot_avx2(long* x, long* y, int n) {
+        __m256i acc = _mm256_setzero_si256();
+        long lanes[4];
+        int i = 0;
+
+        for(; i + 4 <= n; i += 4) {
+            __m256i a = _mm256_loadu_si256((__m256i*)(x + i));
+            __m256i b = _mm256_loadu_si256((__m256i*)(y + i));
+
+            __m256i low = _mm256_mul_epu32(a, b);
+            __m256i cross = _mm256_add_epi64(
+                _mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+                _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32))
+            );
 
-        return val;
+            acc = _mm256_add_epi64(acc, _mm256_add_epi64(low, _mm256_slli_epi64(cross, 32)));
+        }
+
+        _mm256_storeu_si256((__m256i*)lanes, acc);
+
+        return (unsigned long)lanes[0] + lanes[1] + lanes[2] + lanes[3] + lvec_dot_scalar(x + i, y + i, n - i);
     }
+#endif
 
-/* LVAL Util Functions */
-    //Deletes an lval and frees the allocated memory
-    void lval_del(lval* val) {
-        switch(val->type) {
-            //Nothing special for the number or func type
-            case LVAL_FUN:
-                if(!val->builtin) {
-                    lenv_del(val->env);
-                    lval_del(val->formals);
-                    lval_del(val->body);
-                }
-                break;
+    lvec_kernels lvec = {
+        lvec_add_scalar,
+        lvec_sub_scalar,
+        lvec_sum_scalar,
+        lvec_min_scalar,
+        lvec_max_scalar,
+        lvec_dot_scalar
+    };
 
-            case LVAL_NUM: break;
+    //Pick the widest kernels the CPU supports
+    void lvec_init(void) {
+#ifdef LVEC_SIMD
+        __builtin_cpu_init();
 
-            //Free the string memory for error or symbol
-            case LVAL_ERR: free(val->err); break;
-            case LVAL_SYM: free(val->symbol); break;
-            case LVAL_STR: free(val->str); break;
+        lvec.add = lvec_add_sse2;
+        lvec.sub = lvec_sub_sse2;
+        lvec.sum = lvec_sum_sse2;
 
-            //If q-expression or s-expression then delete all elements inside
-            case LVAL_QEXPR:
-            case LVAL_SEXPR:
+        if(__builtin_cpu_supports("sse4.2")) {
+            lvec.min = lvec_min_sse42;
+            lvec.max = lvec_max_sse42;
+        }
 
-                for(int i = 0; i < val->count; i++) {
-                    lval_del(val->cell[i]);
-                }
+        if(__builtin_cpu_supports("avx2")) {
+            lvec.add = lvec_add_avx2;
+            lvec.sub = lvec_sub_avx2;
+            lvec.sum = lvec_sum_avx2;
+            lvec.min = lvec_min_avx2;
+            lvec.max = lvec_max_avx2;
+            lvec.dot = lvec_dot_avx2;
+        }
+#endif
+    }
 
-                //Also free the memory to contain the pointers
-                free(val->cell);
+/* Functions */
+    //Recursively counts the total number of nodes in our Abstract Syntax Tree
+    int number_of_nodes(mpc_ast_t* tree) {
+        if(tree->children_num == 0)
+            return 1;
 
-                break;
+        if(tree->children_num >= 1) {
+            int total = 1;
+
+            for(int i = 0; i < tree->children_num; i++) {
+                total += number_of_nodes(tree->children[i]);
+            }
+
+            return total;
         }
 
-        //Free the memory allocated to lval itself
-        free(val);
+        return 0;
     }
 
-    //Adds an lval to the heap
-    lval* lval_add(lval* parent, lval* toAdd) {
-        parent->count++;
-        parent->cell = realloc(parent->cell, sizeof(lval*) * parent->count);
-        parent->cell[parent->count - 1] = toAdd;
+/* Profiler */
+    //When enabled with --profile, lval_call pushes the site of each lambda it
+    //runs onto a stack. A SIGPROF timer counts ticks in the background and
+    //the ticks are charged to the stack as it stands whenever it is about to
+    //change, so each sample lands on the functions running when it fired.
+    #define LPROF_INTERVAL_US 1000
+    #define LPROF_BUCKETS 256
+
+    //Only the thread that started the profiler records into it
+    __thread int lprof_enabled = 0;
+    char* lprof_path = "lispy.folded";
+    volatile sig_atomic_t lprof_ticks = 0;
+
+    lsite* lprof_sites[LPROF_BUCKETS];
+    lsite lprof_toplevel = { "toplevel", NULL, 0 };
+
+    lsite** lprof_stack = NULL;
+    int lprof_depth = 0;
+    int lprof_cap = 0;
+    long lprof_samples = 0;
+
+    //Collapsed stacks ("a;b;c" -> samples) for flamegraph.pl
+    typedef struct lprof_folded {
+        char* stack;
+        long samples;
+        struct lprof_folded* next;
+    } lprof_folded;
+
+    lprof_folded* lprof_folds[LPROF_BUCKETS];
+
+    //Strings referenced by sites and expressions live for the whole run
+    __thread char* lval_read_file = "<stdin>";
+
+    char* lprof_intern(char* str) {
+        static char** strs = NULL;
+        static int count = 0;
+        static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+        pthread_mutex_lock(&lock);
+
+        for(int i = 0; i < count; i++) {
+            if(strcmp(strs[i], str) == 0) {
+                pthread_mutex_unlock(&lock);
+                return strs[i];
+            }
+        }
 
-        return parent;
-    }
+        strs = realloc(strs, sizeof(char*) * (count + 1));
+        strs[count] = malloc(strlen(str) + 1);
+        strcpy(strs[count], str);
 
-    //Reads a number type lval
-    lval* lval_read_num(mpc_ast_t* tree) {
-        errno = 0;
-        long x = strtol(tree->contents, NULL, 10);
-        return (errno != ERANGE) ? lval_num(x) : lval_err("Invalid Number");
+        char* interned = strs[count++];
+        pthread_mutex_unlock(&lock);
+
+        return interned;
     }
 
-    //Reads a string type lval
-    lval* lval_read_string(mpc_ast_t* tree) {
-        //Cut off the final quote char
-        tree->contents[strlen(tree->contents) - 1] = '\0';
+    //Find or create the site for code read from file:line
+    lsite* lprof_site(char* file, int line) {
+        int bucket = ((unsigned long)file ^ line) % LPROF_BUCKETS;
 
-        //Copy the string without the opening quote
-        char* unescaped = malloc(strlen(tree->contents + 1) + 1);
-        strcpy(unescaped, tree->contents+1);
+        for(lsite* site = lprof_sites[bucket]; site; site = site->next) {
+            if(site->file == file && site->line == line)
+                return site;
+        }
 
-        //Pass through the unescape function
-        unescaped = mpcf_unescape(unescaped);
+        lsite* site = calloc(1, sizeof(lsite));
+        site->name = "lambda";
+        site->file = file;
+        site->line = line;
+        site->next = lprof_sites[bucket];
+        lprof_sites[bucket] = site;
 
-        //Construct a new lval from the string
-        lval* str = lval_str(unescaped);
+        return site;
+    }
 
-        //Free the string in memory and return
-        free(unescaped);
-        return str;
+    void lprof_tick(int sig) {
+        lprof_ticks++;
     }
 
-    //Reads an lval
-    lval* lval_read(mpc_ast_t* tree) {
-        //If symbol or number return conversion to that type
-        if(strstr(tree->tag, "number"))
-            return lval_read_num(tree);
+    //Charge the ticks counted so far to the current stack
+    void lprof_drain(void) {
+        if(!lprof_ticks)
+            return;
 
-        if(strstr(tree->tag, "symbol"))
-            return lval_sym(tree->contents);
+        long ticks = lprof_ticks;
+        lprof_ticks = 0;
+        lprof_samples += ticks;
 
-        //If root or sexpr then create empty list
-        lval* val = NULL;
+        lsite* top = lprof_depth ? lprof_stack[lprof_depth - 1] : &lprof_toplevel;
+        top->selfSamples += ticks;
 
-        if(strcmp(tree->tag, ">") == 0 || strstr(tree->tag, "sexpr"))
-            val = lval_sexpr();
+        //Count each site once however deep it recurses
+        lprof_toplevel.totalSamples += ticks;
+        long len = strlen(lprof_toplevel.name);
 
-        if(strstr(tree->tag, "qexpr"))
-            val = lval_qexpr();
+        for(int i = 0; i < lprof_depth; i++) {
+            if(lprof_stack[i]->mark != lprof_samples) {
+                lprof_stack[i]->mark = lprof_samples;
+                lprof_stack[i]->totalSamples += ticks;
+            }
 
-        if(strstr(tree->tag, "string"))
-            return lval_read_string(tree);
+            len += strlen(lprof_stack[i]->name) + 1;
+        }
 
-        //Fill the list with any valid expression contained within
-        for(int i = 0; i < tree->children_num; i++) {
-            if(strcmp(tree->children[i]->contents, "(") == 0) continue;
-            if(strcmp(tree->children[i]->contents, ")") == 0) continue;
-            if(strcmp(tree->children[i]->contents, "{") == 0) continue;
-            if(strcmp(tree->children[i]->contents, "}") == 0) continue;
-            if(strcmp(tree->children[i]->tag, "regex") == 0) continue;
-            if(strstr(tree->children[i]->tag, "comment")) continue;
+        //Build the collapsed stack and add the ticks to its entry
+        char* stack = malloc(len + 1);
+        strcpy(stack, lprof_toplevel.name);
 
-            val = lval_add(val, lval_read(tree->children[i]));
+        for(int i = 0; i < lprof_depth; i++) {
+            strcat(stack, ";");
+            strcat(stack, lprof_stack[i]->name);
+        }
+
+        unsigned long h = 5381;
+        for(char* c = stack; *c; c++) h = h * 33 + *c;
+
+        lprof_folded** bucket = &lprof_folds[h % LPROF_BUCKETS];
+        lprof_folded* fold = *bucket;
+
+        while(fold && strcmp(fold->stack, stack) != 0) {
+            fold = fold->next;
+        }
+
+        if(fold) {
+            fold->samples += ticks;
+            free(stack);
+        } else {
+            fold = malloc(sizeof(lprof_folded));
+            fold->stack = stack;
+            fold->samples = ticks;
+            fold->next = *bucket;
+            *bucket = fold;
+        }
+    }
+
+    void lprof_enter(lsite* site) {
+        lprof_drain();
+
+        if(lprof_depth == lprof_cap) {
+            lprof_cap = lprof_cap ? lprof_cap * 2 : 64;
+            lprof_stack = realloc(lprof_stack, sizeof(lsite*) * lprof_cap);
+        }
+
+        lprof_stack[lprof_depth++] = site;
+        site->calls++;
+    }
+
+    void lprof_leave(void) {
+        lprof_drain();
+        lprof_depth--;
+    }
+
+    void lprof_alloc(void) {
+        (lprof_depth ? lprof_stack[lprof_depth - 1] : &lprof_toplevel)->allocs++;
+    }
+
+    void lprof_start(void) {
+        lprof_enabled = 1;
+
+#ifndef _WIN32
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = lprof_tick;
+        action.sa_flags = SA_RESTART;
+        sigaction(SIGPROF, &action, NULL);
+
+        struct itimerval timer;
+        timer.it_interval.tv_sec = 0;
+        timer.it_interval.tv_usec = LPROF_INTERVAL_US;
+        timer.it_value = timer.it_interval;
+        setitimer(ITIMER_PROF, &timer, NULL);
+#endif
+    }
+
+    int lprof_cmp(const void* a, const void* b) {
+        lsite* x = *(lsite**)a;
+        lsite* y = *(lsite**)b;
+
+        if(x->selfSamples != y->selfSamples)
+            return (x->selfSamples < y->selfSamples) ? 1 : -1;
+
+        return (x->calls < y->calls) ? 1 : (x->calls > y->calls) ? -1 : 0;
+    }
+
+    //Print the flat profile to stderr and write the collapsed stacks
+    void lprof_report(void) {
+        if(!lprof_enabled)
+            return;
+
+#ifndef _WIN32
+        struct itimerval timer;
+        memset(&timer, 0, sizeof(timer));
+        setitimer(ITIMER_PROF, &timer, NULL);
+#endif
+
+        lprof_drain();
+
+        //Gather every site that did some work
+        int count = 1;
+        lsite** sites = malloc(sizeof(lsite*));
+        sites[0] = &lprof_toplevel;
+
+        for(int i = 0; i < LPROF_BUCKETS; i++) {
+            for(lsite* site = lprof_sites[i]; site; site = site->next) {
+                if(!site->calls) continue;
+
+                sites = realloc(sites, sizeof(lsite*) * (count + 1));
+                sites[count++] = site;
+            }
+        }
+
+        qsort(sites, count, sizeof(lsite*), lprof_cmp);
+
+        double ms = LPROF_INTERVAL_US / 1000.0;
+        long total = lprof_samples ? lprof_samples : 1;
+
+        fprintf(stderr, "\nFlat profile: %li samples every %gms\n", lprof_samples, ms);
+        fprintf(stderr, "%7s %10s %10s %10s %12s  %s\n", "self%", "self ms", "total ms", "calls", "allocs", "function");
+
+        for(int i = 0; i < count; i++) {
+            lsite* site = sites[i];
+
+            fprintf(stderr, "%6.2f%% %10.1f %10.1f %10li %12li  %s",
+                100.0 * site->selfSamples / total, site->selfSamples * ms,
+                site->totalSamples * ms, site->calls, site->allocs, site->name);
+
+            if(site->file)
+                fprintf(stderr, " (%s:%i)", site->file, site->line);
+
+            fputc('\n', stderr);
+        }
+
+        free(sites);
+
+        FILE* out = fopen(lprof_path, "w");
+
+        if(!out) {
+            fprintf(stderr, "Could not write collapsed stacks to %s\n", lprof_path);
+            return;
+        }
+
+        for(int i = 0; i < LPROF_BUCKETS; i++) {
+            for(lprof_folded* fold = lprof_folds[i]; fold; fold = fold->next) {
+                fprintf(out, "%s %li\n", fold->stack, fold->samples);
+            }
+        }
+
+        fclose(out);
+        fprintf(stderr, "Collapsed stacks written to %s\n", lprof_path);
+    }
+
+/* Statistics */
+    //Counters behind (stats) and --stats. They are always kept since each
+    //is a single increment on paths that already do far more work. Frees
+    //count the type at free time, so lists turned from S- to Q-Expressions
+    //are allocated as one and freed as the other.
+    #define LSTATS_BUILTINS 256
+
+    typedef struct {
+        long allocs[LVAL_TYPE_COUNT];
+        long frees[LVAL_TYPE_COUNT];
+        long copies;
+        long copyBytes;
+        long lookups;
+        long lookupDepth;
+        long cacheHits;
+        long evals;
+
+        //Calls per builtin, indexed like lstats_builtins
+        long calls[LSTATS_BUILTINS];
+    } lstats_counters;
+
+    //Each thread counts into its own lstats, which is added to lstats_done
+    //when the thread finishes
+    __thread lstats_counters lstats;
+    lstats_counters lstats_done;
+    pthread_mutex_t lstats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+    //Builtins found by hashing the function pointer
+    typedef struct {
+        lbuiltin func;
+        char* name;
+    } lstats_builtin;
+
+    lstats_builtin lstats_builtins[LSTATS_BUILTINS];
+
+    //Returns the index of func, or of the empty slot it should go in
+    int lstats_builtin_slot(lbuiltin func) {
+        unsigned long i = ((unsigned long)func >> 4) & (LSTATS_BUILTINS - 1);
+
+        while(lstats_builtins[i].func && lstats_builtins[i].func != func) {
+            i = (i + 1) & (LSTATS_BUILTINS - 1);
+        }
+
+        return i;
+    }
+
+    //Counters are all longs, so sets of them add element-wise
+    void lstats_add(lstats_counters* into, lstats_counters* from) {
+        long* to = (long*)into;
+        long* add = (long*)from;
+
+        for(size_t i = 0; i < sizeof(lstats_counters) / sizeof(long); i++) {
+            to[i] += add[i];
+        }
+    }
+
+    //Move this thread's counters into the process total
+    void lstats_flush(void) {
+        pthread_mutex_lock(&lstats_lock);
+        lstats_add(&lstats_done, &lstats);
+        pthread_mutex_unlock(&lstats_lock);
+
+        memset(&lstats, 0, sizeof(lstats));
+    }
+
+    //This thread's counters plus those of every finished thread
+    lstats_counters lstats_total(void) {
+        lstats_counters total = lstats;
+
+        pthread_mutex_lock(&lstats_lock);
+        lstats_add(&total, &lstats_done);
+        pthread_mutex_unlock(&lstats_lock);
+
+        return total;
+    }
+
+/* Threads */
+    //A global env is shared between threads. Lookups in it take a read
+    //lock and definitions a write lock, but only while spawned threads are
+    //running, so a single threaded program pays nothing for it.
+    pthread_rwlock_t lenv_lock = PTHREAD_RWLOCK_INITIALIZER;
+    int lthread_running = 0;
+
+    int lenv_locked(lenv* env) {
+        return env->lock && __atomic_load_n(&lthread_running, __ATOMIC_ACQUIRE);
+    }
+
+    //Where this thread prints: stdout, unless a batch job is capturing it
+    __thread FILE* lout = NULL;
+    #define LOUT (lout ? lout : stdout)
+
+    //Cancel flag of the future this thread is evaluating, if any
+    __thread int* lfuture_cancel = NULL;
+
+    //Each thread keeps the lvals it frees on a list of its own and reuses
+    //them before going to malloc, so threads allocating in parallel don't
+    //contend on the allocator. Freed lvals are chained through body.
+    #define LHEAP_KEEP 4096
+
+    __thread lval* lheap_list = NULL;
+    __thread int lheap_count = 0;
+
+    void lheap_put(lval* val) {
+        if(lheap_count == LHEAP_KEEP) {
+            free(val);
+            return;
+        }
+
+        val->body = lheap_list;
+        lheap_list = val;
+        lheap_count++;
+    }
+
+    //Hand this thread's list back to malloc
+    void lheap_drain(void) {
+        while(lheap_list) {
+            lval* next = lheap_list->body;
+            free(lheap_list);
+            lheap_list = next;
+        }
+
+        lheap_count = 0;
+    }
+
+/* Symbol Names */
+    //Interned names live until exit, chained in buckets of a table that
+    //doubles when it gets as full as it has buckets
+    #define LNAME_BUCKETS 1024
+
+    //Bits of an lname cache that hold the slot, the rest is the version
+    #define LNAME_SLOT_BITS 20
+
+    lname** lname_table = NULL;
+    unsigned long lname_buckets = 0;
+    unsigned long lname_count = 0;
+    pthread_mutex_t lname_lock = PTHREAD_MUTEX_INITIALIZER;
+
+    //Last version handed to a global env
+    unsigned long long lenv_versions = 0;
+
+    unsigned long long lenv_version_next(void) {
+        return __atomic_add_fetch(&lenv_versions, 1, __ATOMIC_RELAXED);
+    }
+
+    void lname_grow(void) {
+        unsigned long buckets = lname_buckets ? lname_buckets * 2 : LNAME_BUCKETS;
+        lname** table = calloc(buckets, sizeof(lname*));
+
+        for(unsigned long i = 0; i < lname_buckets; i++) {
+            while(lname_table[i]) {
+                lname* name = lname_table[i];
+                lname_table[i] = name->next;
+
+                name->next = table[name->hash & (buckets - 1)];
+                table[name->hash & (buckets - 1)] = name;
+            }
+        }
+
+        free(lname_table);
+        lname_table = table;
+        lname_buckets = buckets;
+    }
+
+    //Find the record for len bytes of sym, adding one if it's new
+    lname* lname_intern(char* sym, long len) {
+        unsigned long hash = lhash_bytes(sym, len);
+
+        pthread_mutex_lock(&lname_lock);
+
+        if(lname_count >= lname_buckets)
+            lname_grow();
+
+        lname** bucket = &lname_table[hash & (lname_buckets - 1)];
+
+        for(lname* name = *bucket; name; name = name->next) {
+            if(name->hash == hash && name->len == len && memcmp(name->symbol, sym, len) == 0) {
+                pthread_mutex_unlock(&lname_lock);
+                return name;
+            }
+        }
+
+        lname* name = malloc(sizeof(lname) + len + 1);
+
+        name->hash = hash;
+        name->local = 0;
+        name->pinned = 0;
+        name->cache = 0;
+        name->len = len;
+        memcpy(name->symbol, sym, len);
+        name->symbol[len] = '\0';
+
+        name->next = *bucket;
+        *bucket = name;
+        lname_count++;
+
+        pthread_mutex_unlock(&lname_lock);
+
+        return name;
+    }
+
+/* Constructor/Destructor functions */
+    //Create a new environment
+    lenv* lenv_new(void) {
+        lenv* env = malloc(sizeof(lenv));
+
+        env->parent = NULL;
+        env->root = env;
+        env->lock = NULL;
+        env->version = 0;
+        env->count = 0;
+        env->symbols = NULL;
+        env->lens = NULL;
+        env->vals = NULL;
+
+        return env;
+    }
+
+    void lenv_del(lenv* env) {
+        for(int i = 0; i < env->count; i++) {
+            free(env->symbols[i]);
+            lval_del(env->vals[i]);
+        }
+
+        free(env->symbols);
+        free(env->lens);
+        free(env->vals);
+        free(env);
+    }
+
+    //Looks a name up in the global env alone, for names never bound
+    //anywhere else. The slot it's found at is remembered in its lname, and
+    //used without searching while the env's version stays the same.
+    lval* lenv_get_global(lenv* env, lval* val) {
+        lname* name = val->name;
+
+        int locked = lenv_locked(env);
+        if(locked) pthread_rwlock_rdlock(env->lock);
+
+        unsigned long long cache = __atomic_load_n(&name->cache, __ATOMIC_RELAXED);
+
+        if(env->version && cache >> LNAME_SLOT_BITS == env->version) {
+            lval* result = lval_cpy(env->vals[cache & ((1 << LNAME_SLOT_BITS) - 1)]);
+            if(locked) pthread_rwlock_unlock(env->lock);
+
+            lstats.cacheHits++;
+            return result;
+        }
+
+        lstats.lookupDepth++;
+
+        for(int i = 0; i < env->count; i++) {
+            if(env->lens[i] == val->len && memcmp(env->symbols[i], val->symbol, val->len) == 0) {
+                if(env->version && i < 1 << LNAME_SLOT_BITS)
+                    __atomic_store_n(&name->cache, env->version << LNAME_SLOT_BITS | i, __ATOMIC_RELAXED);
+
+                lval* result = lval_cpy(env->vals[i]);
+                if(locked) pthread_rwlock_unlock(env->lock);
+
+                return result;
+            }
+        }
+
+        if(locked) pthread_rwlock_unlock(env->lock);
+
+        return lval_err("Unbound Symbol: '%s'", val->symbol);
+    }
+
+    lval* lenv_get(lenv* env, lval* val) {
+        lstats.lookups++;
+
+        //Names only ever bound globally can skip the local envs
+        if(env->root->lock && !__atomic_load_n(&val->name->local, __ATOMIC_RELAXED))
+            return lenv_get_global(env->root, val);
+
+        //Check each env up the parent chain
+        for(; env; env = env->parent) {
+            lstats.lookupDepth++;
+
+            int locked = lenv_locked(env);
+            if(locked) pthread_rwlock_rdlock(env->lock);
+
+            //Iterate over all items in env
+            for(int i = 0; i < env->count; i++) {
+                //Check if the stored string matches the symbol string
+                //If it does, return a copy of the value
+                if(env->lens[i] == val->len && memcmp(env->symbols[i], val->symbol, val->len) == 0) {
+                    lval* result = lval_cpy(env->vals[i]);
+                    if(locked) pthread_rwlock_unlock(env->lock);
+
+                    return result;
+                }
+            }
+
+            if(locked) pthread_rwlock_unlock(env->lock);
+        }
+
+        //If no symbol found return err
+        return lval_err("Unbound Symbol: '%s'", val->symbol);
+    }
+
+    //Binds k to v itself rather than a copy, taking ownership of v. Any old
+    //value is freed outside the lock.
+    void lenv_bind(lenv* env, lval* k, lval* v) {
+        //Lookups of a name bound outside a global env can't skip ahead
+        if(!env->lock && !__atomic_load_n(&k->name->local, __ATOMIC_RELAXED))
+            __atomic_store_n(&k->name->local, 1, __ATOMIC_RELAXED);
+
+        int locked = lenv_locked(env);
+        if(locked) pthread_rwlock_wrlock(env->lock);
+
+        //Any change to a global env drops what lookups remember of it
+        if(env->lock)
+            env->version = lenv_version_next();
+
+        //Iterate over all items in env to check if variable exists
+        for(int i = 0; i < env->count; i++) {
+            //If var is found replace the item at that pos
+            if(env->lens[i] == k->len && memcmp(env->symbols[i], k->symbol, k->len) == 0) {
+                lval* old = env->vals[i];
+                env->vals[i] = v;
+
+                if(locked) pthread_rwlock_unlock(env->lock);
+                lval_del(old);
+
+                return;
+            }
+        }
+
+        //If no existing entry found, allocate space for new entry
+        env->count++;
+        env->vals = realloc(env->vals, sizeof(lval*) * env->count);
+        env->symbols = realloc(env->symbols, sizeof(char*) * env->count);
+        env->lens = realloc(env->lens, sizeof(long) * env->count);
+
+        //Copy contents of lval and symbol string into new location
+        env->vals[env->count - 1] = v;
+        env->symbols[env->count - 1] = malloc(k->len + 1);
+        memcpy(env->symbols[env->count - 1], k->symbol, k->len + 1);
+        env->lens[env->count - 1] = k->len;
+
+        if(locked) pthread_rwlock_unlock(env->lock);
+    }
+
+    void lenv_set(lenv* env, lval* k, lval* v) {
+        //Copy outside the lock
+        lenv_bind(env, k, lval_cpy(v));
+    }
+
+    //Copies an environment
+    lenv* lenv_cpy(lenv* env) {
+        lenv* cpy = malloc(sizeof(lenv));
+
+        lstats.copyBytes += sizeof(lenv) + (sizeof(char*) + sizeof(long) + sizeof(lval*)) * env->count;
+
+        cpy->parent = env->parent;
+        cpy->root = env->parent ? env->root : cpy;
+        cpy->lock = NULL;
+
+        //A copy of a global env is given its own version, for when it's made
+        //global in turn
+        cpy->version = env->lock ? lenv_version_next() : 0;
+        cpy->count = env->count;
+        cpy->symbols = malloc(sizeof(char*) * cpy->count);
+        cpy->lens = malloc(sizeof(long) * cpy->count);
+        cpy->vals = malloc(sizeof(lval*) * cpy->count);
+
+        for(int i = 0; i < env->count; i++) {
+            lstats.copyBytes += env->lens[i] + 1;
+            cpy->symbols[i] = malloc(env->lens[i] + 1);
+            memcpy(cpy->symbols[i], env->symbols[i], env->lens[i] + 1);
+            cpy->lens[i] = env->lens[i];
+            cpy->vals[i] = lval_cpy(env->vals[i]);
+        }
+
+        return cpy;
+    }
+
+    //Defines a variable in the global env
+    void lenv_def(lenv* env, lval* key, lval* val) {
+        //Iterate til env has no parent
+        while(env->parent) {
+            env = env->parent;
         }
 
+        //Put value in e
+        lenv_set(env, key, val);
+    }
+
+    //Allocate an lval of the given type, counting it for the profiler
+    lval* lval_alloc(int type) {
+        lval* val = lheap_list;
+
+        if(val) {
+            lheap_list = val->body;
+            lheap_count--;
+        } else {
+            val = malloc(sizeof(lval));
+        }
+
+        val->type = type;
+        lstats.allocs[type]++;
+
+        if(lprof_enabled)
+            lprof_alloc();
+
         return val;
     }
 
-    //Gets an lval at the specified index leaving the list intact
-    lval* lval_pop(lval* val, int index) {
-        //Find the item at 'index'
-        lval* poppedVal = val->cell[index];
+    //Create a new number type lval
+    lval* lval_num(long x) {
+        lval* val = lval_alloc(LVAL_NUM);
 
-        //Shift the memory after the item at 'index'
-        memmove(&val->cell[index], &val->cell[index+1], sizeof(lval*) * (val->count - index - 1));
+        val->num = x;
 
-        //Decrease the count of items in the list
-        val->count--;
+        return val;
+    }
 
-        //Reallocate the memory used
-        val->cell = realloc(val->cell, sizeof(lval*) * val->count);
+    //Create a new symbol type lval from len bytes of sym
+    lval* lval_sym_len(char* sym, long len) {
+        lval* val = lval_alloc(LVAL_SYM);
+
+        val->name = lname_intern(sym, len);
+        val->len = len;
+        val->symbol = val->name->symbol;
+
+        return val;
+    }
+
+    //Create a new symbol type lval
+    lval* lval_sym(char* sym) {
+        return lval_sym_len(sym, strlen(sym));
+    }
+
+    //Create a new s-expr type lval
+    lval* lval_sexpr(void) {
+        lval* val = lval_alloc(LVAL_SEXPR);
+
+        val->count = 0;
+        val->cell = NULL;
+        val->file = NULL;
+        val->line = 0;
+
+        return val;
+    }
+
+    //Create a new q-expr type lval
+    lval* lval_qexpr(void) {
+        lval* val = lval_alloc(LVAL_QEXPR);
+
+        val->count = 0;
+        val->cell = NULL;
+        val->file = NULL;
+        val->line = 0;
+
+        return val;
+    }
+
+    //Create a new function type lval
+    lval* lval_fun(lbuiltin func) {
+        lval* vals = lval_alloc(LVAL_FUN);
+
+        vals->builtin = func;
+        vals->memo = NULL;
+
+        return vals;
+    }
+
+    //Create a new string buffer with room for cap bytes
+    lbuf* lbuf_new(long cap) {
+        lbuf* buf = malloc(sizeof(lbuf) + cap);
+
+        buf->refs = 1;
+        buf->cap = cap;
+        buf->used = 0;
+
+        return buf;
+    }
+
+    void lbuf_release(lbuf* buf) {
+        if(LREF_DEC(buf->refs) == 0)
+            free(buf);
+    }
+
+    //Create a new string type lval viewing len bytes of buf from str
+    lval* lval_slice(lbuf* buf, char* str, long len) {
+        lval* val = lval_alloc(LVAL_STR);
+
+        val->buf = buf;
+        val->str = str;
+        val->len = len;
+        LREF_INC(buf->refs);
+
+        return val;
+    }
+
+    //Create a new string type lval from a copy of len bytes
+    lval* lval_str_len(char* str, long len) {
+        lbuf* buf = lbuf_new(len);
+
+        memcpy(buf->data, str, len);
+        buf->used = len;
+
+        lval* val = lval_slice(buf, buf->data, len);
+        lbuf_release(buf);
+
+        return val;
+    }
+
+    //Create a new string type lval
+    lval* lval_str(char* str) {
+        return lval_str_len(str, strlen(str));
+    }
+
+    //Append n bytes to a string the caller owns. Appends land in place when
+    //the string ends at the end of its buffer's used bytes; otherwise the
+    //string moves to a buffer twice its new length so later appends do.
+    //The bytes are claimed by moving used with a compare and swap, as the
+    //buffer may be shared with strings on other threads.
+    void lval_str_append(lval* val, char* bytes, long n) {
+        lbuf* buf = val->buf;
+        long end = val->str + val->len - buf->data;
+
+        if(end + n <= buf->cap && __atomic_compare_exchange_n(&buf->used, &end, end + n, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            memcpy(buf->data + end, bytes, n);
+            val->len += n;
+            return;
+        }
+
+        long len = val->len + n;
+        lbuf* grown = lbuf_new(len < 8 ? 16 : len * 2);
+
+        memcpy(grown->data, val->str, val->len);
+        memcpy(grown->data + val->len, bytes, n);
+        grown->used = len;
+
+        lbuf_release(buf);
+
+        val->buf = grown;
+        val->str = grown->data;
+        val->len = len;
+    }
+
+    //Returns a NUL terminated copy of a string lval for C APIs
+    char* lval_cstr(lval* val) {
+        char* str = malloc(val->len + 1);
+
+        memcpy(str, val->str, val->len);
+        str[val->len] = '\0';
+
+        return str;
+    }
+
+    //Create a new vector type lval with room for count numbers
+    lval* lval_vec(int count) {
+        lval* val = lval_alloc(LVAL_VEC);
+
+        val->count = count;
+        val->data = malloc(sizeof(long) * count);
+
+        return val;
+    }
+
+    //Create a new empty hash map type lval
+    lval* lval_hash_map(void) {
+        lval* val = lval_alloc(LVAL_HASH);
+
+        val->hash = lhash_new(8);
+
+        return val;
+    }
+
+    //Create a new dict type lval, taking the reference to root
+    lval* lval_dict(lhamt* root, int count) {
+        lval* val = lval_alloc(LVAL_DICT);
+
+        val->dict = root;
+        val->count = count;
+
+        return val;
+    }
+
+    //Create a new thread type lval, taking a reference to thread
+    lval* lval_thread(lthread* thread) {
+        lval* val = lval_alloc(LVAL_THREAD);
+
+        val->thread = thread;
+
+        return val;
+    }
+
+    //Create a new future type lval, taking a reference to future
+    lval* lval_future(lfuture* future) {
+        lval* val = lval_alloc(LVAL_FUTURE);
+
+        val->future = future;
+
+        return val;
+    }
+
+    //Create a new isolate type lval, taking a reference to iso
+    lval* lval_isolate(lisolate* iso) {
+        lval* val = lval_alloc(LVAL_ISOLATE);
+
+        val->isolate = iso;
+
+        return val;
+    }
+
+    //Create a new lazy sequence type lval, taking a reference to seq
+    lval* lval_seq(lseq* seq) {
+        lval* val = lval_alloc(LVAL_SEQ);
+
+        val->seq = seq;
+
+        return val;
+    }
+
+    //Create a new file type lval, taking a reference to file
+    lval* lval_file(lfile* file) {
+        lval* val = lval_alloc(LVAL_FILE);
+
+        val->stream = file;
+
+        return val;
+    }
+
+    lval* lval_lambda(lval* formals, lval* body) {
+        lval* result = lval_alloc(LVAL_FUN);
+
+        //Set builtin to NULL
+        result->builtin = NULL;
+        result->memo = NULL;
+
+        //Build new environment
+        result->env = lenv_new();
+
+        //Set formals and body
+        result->formals = formals;
+        result->body = body;
+
+        //Identify where the body came from when profiling
+        result->site = lprof_enabled ? lprof_site(body->file, body->line) : NULL;
+
+        return result;
+    }
+
+    //Create a new error type lval
+    lval* lval_err(char* fmt, ...) {
+
+        lval* val = lval_alloc(LVAL_ERR);
+
+        //Create va list and initialize it
+        va_list va;
+        va_start(va, fmt);
+
+        val->err = malloc(512);
+
+        //printf the error with the string w/ max of 511 chars
+        int len = vsnprintf(val->err, 512, fmt, va);
+        val->len = (len < 0) ? 0 : (len > 511) ? 511 : len;
+
+        //Reallocate to numer of bytes actually used
+        val->err = realloc(val->err, val->len + 1);
+
+        //clean up the va list
+        va_end(va);
+
+        return val;
+    }
+
+/* LVAL Util Functions */
+    //Deletes an lval and frees the allocated memory
+    void lval_del(lval* val) {
+        lstats.frees[val->type]++;
+
+        switch(val->type) {
+            //Nothing special for the number or func type
+            case LVAL_FUN:
+                if(!val->builtin) {
+                    lenv_del(val->env);
+                    lval_del(val->formals);
+                    lval_del(val->body);
+                }
+
+                if(val->memo)
+                    lmemo_release(val->memo);
+                break;
+
+            case LVAL_NUM: break;
+
+            //Free the string memory for error, symbols share interned data
+            case LVAL_ERR: free(val->err); break;
+            case LVAL_SYM: break;
+            case LVAL_STR: lbuf_release(val->buf); break;
+            case LVAL_VEC: free(val->data); break;
+            case LVAL_HASH: lhash_del(val->hash); break;
+            case LVAL_DICT: lhamt_release(val->dict); break;
+            case LVAL_THREAD: lthread_release(val->thread); break;
+            case LVAL_FUTURE: lfuture_release(val->future); break;
+            case LVAL_ISOLATE: lisolate_release(val->isolate); break;
+            case LVAL_SEQ: lseq_release(val->seq); break;
+            case LVAL_FILE: lfile_release(val->stream); break;
+
+            //If q-expression or s-expression then delete all elements inside
+            case LVAL_QEXPR:
+            case LVAL_SEXPR:
+
+                for(int i = 0; i < val->count; i++) {
+                    lval_del(val->cell[i]);
+                }
+
+                //Also free the memory to contain the pointers
+                free(val->cell);
+
+                break;
+        }
+
+        //Return the memory allocated to lval itself to this thread's heap
+        lheap_put(val);
+    }
+
+    //Adds an lval to the heap
+    lval* lval_add(lval* parent, lval* toAdd) {
+        parent->count++;
+        parent->cell = realloc(parent->cell, sizeof(lval*) * parent->count);
+        parent->cell[parent->count - 1] = toAdd;
+
+        return parent;
+    }
+
+    //Reads a number type lval
+    lval* lval_read_num(mpc_ast_t* tree) {
+        errno = 0;
+        long x = strtol(tree->contents, NULL, 10);
+        return (errno != ERANGE) ? lval_num(x) : lval_err("Invalid Number");
+    }
+
+    //Writes out what a sink has collected
+    void lsink_flush(lsink* sink) {
+        if(sink->out && sink->len)
+            fwrite(sink->data, 1, sink->len, sink->out);
+
+        sink->len = 0;
+    }
+
+    void lsink_write(lsink* sink, char* bytes, long n) {
+        if(sink->len + n > sink->cap) {
+            if(sink->out) {
+                lsink_flush(sink);
+
+                //Too big to collect, so write it straight out
+                if(n > sink->cap) {
+                    fwrite(bytes, 1, n, sink->out);
+                    return;
+                }
+            } else {
+                while(sink->len + n > sink->cap) {
+                    sink->cap *= 2;
+                }
+
+                sink->data = realloc(sink->data, sink->cap);
+            }
+        }
+
+        memcpy(sink->data + sink->len, bytes, n);
+        sink->len += n;
+    }
+
+    void lsink_putc(lsink* sink, char c) {
+        if(sink->len < sink->cap)
+            sink->data[sink->len++] = c;
+        else
+            lsink_write(sink, &c, 1);
+    }
+
+    void lsink_puts(lsink* sink, char* str) {
+        lsink_write(sink, str, strlen(str));
+    }
+
+    //Writes a number in decimal, without going through printf
+    void lsink_num(lsink* sink, long num) {
+        char digits[24];
+        int i = sizeof(digits);
+        unsigned long x = num < 0 ? 0UL - (unsigned long)num : (unsigned long)num;
+
+        do {
+            digits[--i] = '0' + x % 10;
+            x /= 10;
+        } while(x);
+
+        if(num < 0)
+            digits[--i] = '-';
+
+        lsink_write(sink, digits + i, sizeof(digits) - i);
+    }
+
+    //Returns the escape sequence for a character in a string literal, or
+    //NULL if it can be written as is
+    char* lval_escape(char c) {
+        switch(c) {
+            case '\a': return "\\a";
+            case '\b': return "\\b";
+            case '\f': return "\\f";
+            case '\n': return "\\n";
+            case '\r': return "\\r";
+            case '\t': return "\\t";
+            case '\v': return "\\v";
+            case '\\': return "\\\\";
+            case '\'': return "\\'";
+            case '\"': return "\\\"";
+            case '\0': return "\\0";
+        }
+
+        return NULL;
+    }
+
+    //Returns the character for the escape sequence ending in c, or -1
+    int lval_unescape(char c) {
+        switch(c) {
+            case 'a': return '\a';
+            case 'b': return '\b';
+            case 'f': return '\f';
+            case 'n': return '\n';
+            case 'r': return '\r';
+            case 't': return '\t';
+            case 'v': return '\v';
+            case '\\': return '\\';
+            case '\'': return '\'';
+            case '\"': return '\"';
+            case '0': return '\0';
+        }
+
+        return -1;
+    }
+
+    //Reads a string type lval
+    lval* lval_read_string(mpc_ast_t* tree) {
+        //Skip the surrounding quote chars
+        char* src = tree->contents + 1;
+        long len = strlen(src) - 1;
+
+        //Unescape straight into the new string's buffer
+        lbuf* buf = lbuf_new(len);
+
+        for(long i = 0; i < len; i++) {
+            char c = src[i];
+
+            if(c == '\\' && i + 1 < len && lval_unescape(src[i + 1]) >= 0) {
+                c = lval_unescape(src[++i]);
+            }
+
+            buf->data[buf->used++] = c;
+        }
+
+        lval* str = lval_slice(buf, buf->data, buf->used);
+        lbuf_release(buf);
+
+        return str;
+    }
+
+    //Reads an lval
+    lval* lval_read(mpc_ast_t* tree) {
+        //If symbol or number return conversion to that type
+        if(strstr(tree->tag, "number"))
+            return lval_read_num(tree);
+
+        if(strstr(tree->tag, "symbol"))
+            return lval_sym(tree->contents);
+
+        //If root or sexpr then create empty list
+        lval* val = NULL;
+
+        if(strcmp(tree->tag, ">") == 0 || strstr(tree->tag, "sexpr"))
+            val = lval_sexpr();
+
+        if(strstr(tree->tag, "qexpr"))
+            val = lval_qexpr();
+
+        //Remember where expressions came from
+        if(val) {
+            val->file = lval_read_file;
+            val->line = tree->state.row + 1;
+        }
+
+        if(strstr(tree->tag, "string"))
+            return lval_read_string(tree);
+
+        //Fill the list with any valid expression contained within
+        for(int i = 0; i < tree->children_num; i++) {
+            if(strcmp(tree->children[i]->contents, "(") == 0) continue;
+            if(strcmp(tree->children[i]->contents, ")") == 0) continue;
+            if(strcmp(tree->children[i]->contents, "{") == 0) continue;
+            if(strcmp(tree->children[i]->contents, "}") == 0) continue;
+            if(strcmp(tree->children[i]->tag, "regex") == 0) continue;
+            if(strstr(tree->children[i]->tag, "comment")) continue;
+
+            val = lval_add(val, lval_read(tree->children[i]));
+        }
+
+        return val;
+    }
+
+    //Gets an lval at the specified index leaving the list intact
+    lval* lval_pop(lval* val, int index) {
+        //Find the item at 'index'
+        lval* poppedVal = val->cell[index];
+
+        //Shift the memory after the item at 'index'
+        memmove(&val->cell[index], &val->cell[index+1], sizeof(lval*) * (val->count - index - 1));
+
+        //Decrease the count of items in the list
+        val->count--;
+
+        //Reallocate the memory used
+        val->cell = realloc(val->cell, sizeof(lval*) * val->count);
+
+        return poppedVal;
+    }
+
+    //Same as lval_pop, but deletes remaining list
+    lval* lval_take(lval* val, int index) {
+        lval* takeVal = lval_pop(val, index);
+        lval_del(val);
+
+        return takeVal;
+    }
+
+    //Evaluate an lval
+    lval* lval_eval(lenv* env, lval* val) {
+        lstats.evals++;
+
+        //Evaluate symbols
+        if(val->type == LVAL_SYM) {
+            lval* res = lenv_get(env, val);
+            lval_del(val);
+
+            return res;
+        }
+
+        //Evaluate s-expressions
+        if(val->type == LVAL_SEXPR)
+            return lval_eval_sexpr(env, val);
+
+        //All other lval types remain the same
+        return val;
+    }
+
+    //Variadic sums at least this long are gathered and reduced with SIMD
+    #define LVAL_OP_VECTOR_MIN 8
+
+    //Numbers are gathered onto the stack this many at a time for the kernels
+    #define LVAL_OP_VECTOR_CHUNK 256
+
+    //Sums the numbers after the first operand with the vector kernels. Like the
+    //element-wise loop the sum wraps on overflow, so the result is the same.
+    unsigned long builtin_op_vector_sum(lval* args) {
+        long nums[LVAL_OP_VECTOR_CHUNK];
+        unsigned long total = 0;
+
+        for(int i = 1; i < args->count; i += LVAL_OP_VECTOR_CHUNK) {
+            int n = args->count - i;
+            if(n > LVAL_OP_VECTOR_CHUNK) n = LVAL_OP_VECTOR_CHUNK;
+
+            for(int j = 0; j < n; j++)
+                nums[j] = args->cell[i + j]->num;
+
+            total += (unsigned long)lvec.sum(nums, n);
+        }
+
+        return total;
+    }
+
+    //Perform an operation on an expression
+    lval* builtin_op(lenv* env, lval* args, char* op) {
+        LASSERT(args, args->count != 0, "Function '%s' passed no arguments.", op);
+
+        //Ensure all args are numbers
+        for(int i = 0; i < args->count; i++) {
+            if(args->cell[i]->type != LVAL_NUM) {
+                lval_del(args);
+
+                return lval_err("Cannot operate on non-number!");
+            }
+        }
+
+        int count = args->count;
+        long x = args->cell[0]->num;
+
+        //If no arguments and sub then perform unary negation
+        if(op[0] == '-' && count == 1) {
+            x = 0UL - (unsigned long)x;
+        }
+
+        //Long sums and differences skip the element-wise loop
+        if((op[0] == '+' || op[0] == '-') && count >= LVAL_OP_VECTOR_MIN) {
+            unsigned long total = builtin_op_vector_sum(args);
+
+            x = (op[0] == '+') ? (unsigned long)x + total : (unsigned long)x - total;
+            count = 1;
+        }
+
+        //Apply the operator to each remaining element in turn
+        for(int i = 1; i < count; i++) {
+            long y = args->cell[i]->num;
+
+            switch(op[0]) {
+                case '+': x = (unsigned long)x + y; break;
+                case '-': x = (unsigned long)x - y; break;
+                case '*': x = (unsigned long)x * y; break;
+
+                case '/':
+                case '%':
+                    if(y == 0) {
+                        lval_del(args);
+
+                        return lval_err("Cannot Divide by Zero!");
+                    }
+
+                    x = (op[0] == '/') ? x / y : x % y;
+                    break;
+
+                case '^': x = pow(x, y); break;
+            }
+        }
+
+        lval_del(args);
+
+        return lval_num(x);
+    }
+
+    //Errors printed by load on this thread, for batch exit statuses
+    __thread long lload_errors = 0;
+
+    lval* builtin_load(lenv* env, lval* args) {
+        LASSERT_NUM("load", args, 1);
+        LASSERT_TYPE("load", args, 0, LVAL_STR);
+
+        mpc_result_t result;
+        char* path = lval_cstr(args->cell[0]);
+        int parsed = mpc_parse_contents(path, Lispy, &result);
+
+        if(parsed) {
+            //Read contents, tagging expressions with the file name
+            char* file = lval_read_file;
+            lval_read_file = lprof_intern(path);
+
+            lval* expr = lval_read(result.output);
+            mpc_ast_delete(result.output);
+
+            lval_read_file = file;
+            free(path);
+
+            //Evaluate the expressions
+            while(expr->count) {
+                lval* x = lval_eval(env, lval_pop(expr, 0));
+
+                //If evaluation leads to error print it
+                if(x->type == LVAL_ERR) {
+                    lval_println(x);
+                    lload_errors++;
+                }
+
+                lval_del(x);
+            }
+
+            //Delete the expressions and args
+            lval_del(expr);
+            lval_del(args);
+
+            //Return an empty list
+            return lval_sexpr();
+        } else {
+            free(path);
+
+            //Get parse error as string
+            char* err_msg = mpc_err_string(result.error);
+
+            mpc_err_delete(result.error);
+
+            //Create new error message
+            lval* err = lval_err("Could not load file %s", err_msg);
+
+            //Cleanup and return error
+            free(err_msg);
+            lval_del(args);
+
+            return err;
+        }
+    }
+
+    lval* builtin_print(lenv* env, lval* args) {
+        char data[LSINK_SIZE];
+        lsink sink = { data, 0, sizeof(data), LOUT };
+
+        //Keep the line whole if other threads print too
+        flockfile(LOUT);
+
+        //Print each arg followed by a space
+        for(int i = 0; i < args->count; i++) {
+            lval_sink(&sink, args->cell[i]);
+            lsink_putc(&sink, ' ');
+        }
+
+        //Print a newline and delete args
+        lsink_putc(&sink, '\n');
+        lsink_flush(&sink);
+        funlockfile(LOUT);
+        lval_del(args);
+
+        return lval_sexpr();
+    }
+
+    lval* builtin_err(lenv* env, lval* args) {
+        LASSERT_NUM("error", args, 1);
+        LASSERT_TYPE("error", args, 0, LVAL_STR);
+
+        //Construct error from first arg
+        lval* err = lval_err("%.*s", (int)args->cell[0]->len, args->cell[0]->str);
+
+        //Delete args and return
+        lval_del(args);
+
+        return err;
+    }
+
+    lval* builtin_head(lenv* env, lval* val) {
+        //Check error conditions
+        LASSERT(val, val->count == 1, "Argument Error: Function 'head' was passed too many arguments. Got: %i Expected: %i", val->count, 1);
+        LASSERT(val, val->cell[0]->type == LVAL_QEXPR, "Type Error: Function 'head' expects type Q-Expression. Got: %s Expected: %s", ltype_name(val->cell[0]->type), ltype_name(LVAL_QEXPR));
+        LASSERT(val, val->cell[0]->count != 0, "Empty Expression: Function 'head' expects at least one value. Passed: {}");
+
+        //Otherwise take first arg
+        lval* newVal = lval_take(val, 0);
+
+        //Delete all elements that are not the head and return
+        while(newVal->count > 1) {
+            lval_del(lval_pop(newVal, 1));
+        }
+
+        return newVal;
+    }
+
+    lval* builtin_tail(lenv* env, lval* val) {
+        //Check error conditions
+        LASSERT(val, val->count == 1, "Argument Error: Function 'tail' was passed too many arguments. Got: %i Expected: %i", val->count, 1);
+        LASSERT(val, val->cell[0]->type == LVAL_QEXPR, "Type Error: Function 'tail' expects type Q-Expression. Got: %s Expected: %s", ltype_name(val->cell[0]->type), ltype_name(LVAL_QEXPR));
+        LASSERT(val, val->cell[0]->count != 0, "Empty Expression: Function 'tail' expects at least one value. Passed: {}");
+
+        //Otherwise take first arg
+        lval* newVal = lval_take(val, 0);
+
+        //Delete the first and return
+        lval_del(lval_pop(newVal, 0));
+
+        return newVal;
+    }
+
+    lval* builtin_list(lenv* env, lval* val) {
+        val->type = LVAL_QEXPR;
+        return val;
+    }
+
+    lval* builtin_eval(lenv* env, lval* val) {
+        LASSERT(val, val->count == 1, "Argument Error: Function 'eval' passed too many arguments. Got: %i Expected: %i", val->count, 1);
+        LASSERT(val, val->cell[0]->type == LVAL_QEXPR, "Type Error: Function 'eval' expects type Q-Expression. Got: %s Expected: %s", ltype_name(val->cell[0]->type), ltype_name(LVAL_QEXPR));
+
+        lval* result = lval_take(val, 0);
+        result->type = LVAL_SEXPR;
+
+        return lval_eval(env, result);
+    }
+
+    lval* lval_join(lenv* env, lval* exp1, lval* exp2) {
+        //For each cell in 'exp2' add it to 'exp1'
+        while(exp2->count) {
+            exp1 = lval_add(exp1, lval_pop(exp2, 0));
+        }
+
+        //Delete the empty 'exp2'
+        lval_del(exp2);
+
+        return exp1;
+    }
+
+    //Free an arg list whose first bound args were handed over to an env
+    void lval_drop_bound(lval* args, int bound) {
+        args->count -= bound;
+        memmove(args->cell, args->cell + bound, sizeof(lval*) * args->count);
+        lval_del(args);
+    }
+
+    lval* lval_call(lenv* env, lval* func, lval* args) {
+        //Memoized functions answer from their cache when they can
+        if(func->memo) {
+            return lmemo_call(env, func, args);
+        }
+
+        //If builtin, then simply apply that
+        if(func->builtin) {
+            lstats.calls[lstats_builtin_slot(func->builtin)]++;
+            return func->builtin(env, args);
+        }
+
+        //Stop a cancelled future at its next call
+        if(lfuture_cancel && __atomic_load_n(lfuture_cancel, __ATOMIC_RELAXED)) {
+            lval_del(args);
+            return lval_err("Future cancelled");
+        }
+
+        //Record arg counts
+        int given = args->count;
+        int total = func->formals->count;
+
+        //Args are handed over to the function's env as they're bound, so
+        //none are copied
+        int next = 0;
+
+        //While args still remain to be processed
+        while(args && next < args->count) {
+            //If we run out of formal args to bind
+            if(func->formals->count == 0) {
+                lval_drop_bound(args, next);
+                return lval_err("Function passed too many arguments. Got %i, Expected %i", given, total);
+            }
+
+            //Pop the first symbol from the formals
+            lval* sym = lval_pop(func->formals, 0);
+
+            //The symbol after & is bound to the rest of the args as a list,
+            //made from the arg list itself
+            if(sym->len == 1 && sym->symbol[0] == '&') {
+                lval_del(sym);
+
+                if(func->formals->count != 1) {
+                    lval_drop_bound(args, next);
+                    return lval_err("Function format invalid. Symbol '&' not followed by single symbol.");
+                }
+
+                sym = lval_pop(func->formals, 0);
+
+                args->count -= next;
+                memmove(args->cell, args->cell + next, sizeof(lval*) * args->count);
+                args->type = LVAL_QEXPR;
+
+                lenv_bind(func->env, sym, args);
+                lval_del(sym);
+
+                args = NULL;
+                break;
+            }
+
+            //Bind the next arg into the function's env
+            lenv_bind(func->env, sym, args->cell[next++]);
+            lval_del(sym);
+        }
+
+        //The arg list has been bound and can be cleaned up
+        if(args)
+            lval_drop_bound(args, next);
+
+        //With no args left for &, the symbol after it is bound to {}
+        if(func->formals->count > 0 && func->formals->cell[0]->len == 1 && func->formals->cell[0]->symbol[0] == '&') {
+            if(func->formals->count != 2)
+                return lval_err("Function format invalid. Symbol '&' not followed by single symbol.");
+
+            lval_del(lval_pop(func->formals, 0));
+            lval* sym = lval_pop(func->formals, 0);
+            lenv_bind(func->env, sym, lval_qexpr());
+            lval_del(sym);
+        }
+
+        //If all formals have been bound, evaluate
+        if(func->formals->count == 0) {
+            //Set env parent to evaluation env
+            func->env->parent = env;
+            func->env->root = env->root;
+
+            //Lambdas made on the profiled thread may be called on others
+            lsite* site = lprof_enabled ? func->site : NULL;
+
+            if(site)
+                lprof_enter(site);
+
+            //Evaluate the body in place and return
+            lval* result = lval_eval_sexpr_ref(func->env, func->body);
+
+            if(site)
+                lprof_leave();
+
+            return result;
+        } else {
+            //Otherwise return partially evaluated function
+            return lval_cpy(func);
+        }
+    }
+
+    lval* builtin_join(lenv* env, lval* val) {
+        //Joining a thread waits for its result
+        if(val->count == 1 && val->cell[0]->type == LVAL_THREAD)
+            return builtin_join_thread(env, val);
+
+        for(int i = 0; i < val->count; i++) {
+            LASSERT(val, val->cell[0]->type == LVAL_QEXPR, "Type Error: Function 'join' expects type Q-Expression. Got: %s", ltype_name(val->cell[0]->type));
+        }
+
+        lval* result = lval_pop(val, 0);
+
+        while(val->count) {
+            result = lval_join(env, result, lval_pop(val, 0));
+        }
+
+        lval_del(val);
+
+        return result;
+    }
+
+    lval* builtin_var(lenv* env, lval* val, char* func) {
+        LASSERT(val, val->cell[0]->type == LVAL_QEXPR, "Type Error: Function '%s' expects type Q-Expression. Got: %s", func, ltype_name(val->cell[0]->type));
+
+        //First arg in symbol list
+        lval* syms = val->cell[0];
+
+        //Ensure all elements are symbols
+        for(int i = 0; i < syms->count; i++) {
+            LASSERT(val, syms->cell[i]->type == LVAL_SYM, "Define Error: Function '%s' cannot define non-symbol. Got: %s Expected: %s", func, ltype_name(syms->cell[i]->type), ltype_name(LVAL_SYM));
+        }
+
+        //Check correct number of symbols and vals
+        LASSERT(val, syms->count == val->count - 1, "Define Error: Function '%s' expects equal number of values to symbols. Got: %i Expected: %i", func, syms->count, val->count-1);
+
+        //Values optimized code was built with can't change
+        for(int i = 0; i < syms->count; i++) {
+            lval* err = lopt_redefine(env, syms->cell[i], val->cell[i+1]);
+
+            if(err) {
+                lval_del(val);
+                return err;
+            }
+        }
+
+        //Assign copies of vals to symbols
+        for(int i = 0; i < syms->count; i++) {
+            //If def define globally, if put define locally
+            if(strcmp(func, "def") == 0) {
+                //Name the code a lambda came from after the first global it's bound to
+                lval* fun = val->cell[i+1];
+
+                if(lprof_enabled && fun->type == LVAL_FUN && fun->site && strcmp(fun->site->name, "lambda") == 0)
+                    fun->site->name = lprof_intern(syms->cell[i]->symbol);
+
+                lenv_def(env, syms->cell[i], val->cell[i+1]);
+            } else if(strcmp(func, "=") == 0) {
+                lenv_set(env, syms->cell[i], val->cell[i+1]);
+            }
+        }
+
+        lval_del(val);
+        return lval_sexpr();
+    }
+
+    lval* builtin_def(lenv* env, lval* args) {
+        return builtin_var(env, args, "def");
+    }
+
+    lval* builtin_put(lenv* env, lval* args) {
+        return builtin_var(env, args, "=");
+    }
+
+    lval* builtin_lambda(lenv* env, lval* args) {
+        //Check two args each of which are Q-Exprs
+        LASSERT_NUM("\\", args, 2);
+        LASSERT_TYPE("\\", args, 0, LVAL_QEXPR);
+        LASSERT_TYPE("\\", args, 1, LVAL_QEXPR);
+
+        //Check first expression contains only symbols
+        for(int i = 0; i < args->cell[0]->count; i++) {
+            LASSERT(
+                args,
+                (args->cell[0]->cell[i]->type == LVAL_SYM),
+                "Cannot define non-symbol. Got %s, Expected %s",
+                ltype_name(args->cell[0]->cell[i]->type),
+                ltype_name(LVAL_SYM)
+            );
+
+            //Scoping is dynamic, so a parameter would hide the value from
+            //every function called meanwhile
+            LASSERT(args, !lopt_reserved(args->cell[0]->cell[i]),
+                "Cannot use '%s' as a parameter, --optimize builds in its value", args->cell[0]->cell[i]->symbol);
+        }
+
+        //Pop first 2 args and pass to lval_lambda
+        lval* formals = lval_pop(args, 0);
+        lval* body = lopt_body(env, lval_pop(args, 0));
+        lval_del(args);
+
+        return lval_lambda(formals, body);
+    }
+
+/* Arithemetic Builtins */
+    lval* builtin_add(lenv* env, lval* args) {
+        return builtin_op(env, args, "+");
+    }
+
+    lval* builtin_sub(lenv* env, lval* args) {
+        return builtin_op(env, args, "-");
+    }
+
+    lval* builtin_mult(lenv* env, lval* args) {
+        return builtin_op(env, args, "*");
+    }
+
+    lval* builtin_div(lenv* env, lval* args) {
+        return builtin_op(env, args, "/");
+    }
+
+    lval* builtin_pow(lenv* env, lval* args) {
+        return builtin_op(env, args, "^");
+    }
+
+    lval* builtin_mod(lenv* env, lval* args) {
+        return builtin_op(env, args, "%");
+    }
+
+    lval* builtin(lenv* env, lval* val, char* func) {
+        if (strcmp("list", func) == 0) { return builtin_list(env, val); }
+        if (strcmp("head", func) == 0) { return builtin_head(env, val); }
+        if (strcmp("tail", func) == 0) { return builtin_tail(env, val); }
+        if (strcmp("join", func) == 0) { return builtin_join(env, val); }
+        if (strcmp("eval", func) == 0) { return builtin_eval(env, val); }
+        if (strstr("+-/*^", func)) { return builtin_op(env, val, func); }
+
+        lval_del(val);
+
+        return lval_err("Unknown Function!");
+    }
+
+/* Conditional Builtins */
+    lval* builtin_ord(lenv* env, lval* args, char* op) {
+        //Ensure all args are numbers
+        LASSERT_NUM(op, args, 2);
+        LASSERT_TYPE(op, args, 0, LVAL_NUM);
+        LASSERT_TYPE(op, args, 1, LVAL_NUM);
+
+        int cmpResult = 0;
+
+        if(strcmp(op, ">") == 0) {
+            cmpResult = (args->cell[0]->num > args->cell[1]->num);
+        }
+
+        if(strcmp(op, ">=") == 0) {
+            cmpResult = (args->cell[0]->num >= args->cell[1]->num);
+        }
+
+        if(strcmp(op, "<") == 0) {
+            cmpResult = (args->cell[0]->num < args->cell[1]->num);
+        }
+
+        if(strcmp(op, "<=") == 0) {
+            cmpResult = (args->cell[0]->num <= args->cell[1]->num);
+        }
+
+        lval_del(args);
+
+        return lval_num(cmpResult);
+    }
+
+    lval* builtin_gt(lenv* env, lval* args) {
+        return builtin_ord(env, args, ">");
+    }
+
+    lval* builtin_gte(lenv* env, lval* args) {
+        return builtin_ord(env, args, ">=");
+    }
+
+    lval* builtin_lt(lenv* env, lval* args) {
+        return builtin_ord(env, args, "<");
+    }
+
+    lval* builtin_lte(lenv* env, lval* args) {
+        return builtin_ord(env, args, "<=");
+    }
+
+    //Checks every entry under node is present with an equal value in root
+    int lhamt_subset(lhamt* node, lhamt* root) {
+        if(!node)
+            return 1;
+
+        if(!node->leaf) {
+            for(int i = 0; i < node->count; i++) {
+                if(!lhamt_subset(node->children[i], root))
+                    return 0;
+            }
+
+            return 1;
+        }
+
+        for(int i = 0; i < node->count; i++) {
+            lval* val = lhamt_get(root, node->hash, node->keys[i]);
+
+            if(!val || !lval_eq(val, node->vals[i]))
+                return 0;
+        }
+
+        return 1;
+    }
+
+    int lval_eq(lval* x, lval* y) {
+        /* Different types are always unequal */
+        if(x->type != y->type)
+            return 0;
+
+        //Compare base upon type
+        switch(x->type) {
+            //Compare num value
+            case LVAL_NUM:
+                return x->num == y->num;
+
+            //Compare string vals
+            case LVAL_ERR:
+                return x->len == y->len && memcmp(x->err, y->err, x->len) == 0;
+            case LVAL_SYM:
+                return x->len == y->len && memcmp(x->symbol, y->symbol, x->len) == 0;
+
+            //If builtin compare, otherwise compare formals and body
+            case LVAL_FUN:
+                if(x->builtin || y->builtin)
+                    return x->builtin == y->builtin;
+                else
+                    return lval_eq(x->formals, y->formals) && lval_eq(x->body, y->body);
+
+            //If list compare each element
+            case LVAL_QEXPR:
+            case LVAL_SEXPR:
+                //First check num of elements
+                if(x->count != y->count)
+                    return 0;
+
+                for(int i = 0; i < x->count; i++) {
+                    //If any element is not equal then bail
+                    if(!lval_eq(x->cell[i], y->cell[i]))
+                        return 0;
+                }
+
+                //Otherwise lists must be equal
+                return 1;
+
+            case LVAL_STR:
+                return x->len == y->len && memcmp(x->str, y->str, x->len) == 0;
+
+            case LVAL_VEC:
+                return x->count == y->count && memcmp(x->data, y->data, sizeof(long) * x->count) == 0;
+
+            //Maps are equal when every key maps to an equal value in both
+            case LVAL_HASH:
+                if(x->hash->count != y->hash->count)
+                    return 0;
+
+                for(int i = 0; i < x->hash->cap; i++) {
+                    if(!x->hash->keys[i])
+                        continue;
+
+                    int slot = lhash_find(y->hash, x->hash->keys[i], x->hash->hashes[i]);
+
+                    if(slot < 0 || !lval_eq(x->hash->vals[i], y->hash->vals[slot]))
+                        return 0;
+                }
+
+                return 1;
+
+            case LVAL_DICT:
+                if(x->count != y->count)
+                    return 0;
+
+                return x->dict == y->dict || lhamt_subset(x->dict, y->dict);
+
+            //Threads are only equal to handles on the same thread
+            case LVAL_THREAD:
+                return x->thread == y->thread;
+
+            case LVAL_FUTURE:
+                return x->future == y->future;
+
+            case LVAL_ISOLATE:
+                return x->isolate == y->isolate;
+
+            //Comparing items would force sequences, which may not end
+            case LVAL_SEQ:
+                return x->seq == y->seq;
+
+            case LVAL_FILE:
+                return x->stream == y->stream;
+
+            break;
+        }
+
+        //If we're here, bail since something went wrong
+        return 0;
+    }
+
+/* Hash Tables */
+    //Mix the bits of a word so nearby numbers land in different buckets
+    unsigned long lhash_mix(unsigned long x) {
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdUL;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53UL;
+        x ^= x >> 33;
+
+        return x;
+    }
+
+    //FNV-1a over a run of bytes
+    unsigned long lhash_bytes(char* bytes, long len) {
+        unsigned long h = 14695981039346656037UL;
+
+        for(long i = 0; i < len; i++) {
+            h ^= (unsigned char)bytes[i];
+            h *= 1099511628211UL;
+        }
+
+        return h;
+    }
+
+    unsigned long lval_hash(lval* val);
+
+    //Order independent hash of the entries under a trie node
+    unsigned long lhamt_hash(lhamt* node) {
+        unsigned long h = 0;
+
+        if(!node)
+            return h;
+
+        for(int i = 0; i < node->count; i++) {
+            if(node->leaf)
+                h += lhash_mix(node->hash ^ lval_hash(node->vals[i]));
+            else
+                h += lhamt_hash(node->children[i]);
+        }
+
+        return h;
+    }
+
+    //Hash an lval structurally so that lval_eq values always hash the same
+    unsigned long lval_hash(lval* val) {
+        unsigned long h = lhash_mix(val->type + 1);
+
+        switch(val->type) {
+            case LVAL_NUM: return h ^ lhash_mix(val->num);
+            case LVAL_ERR: return h ^ lhash_bytes(val->err, val->len);
+            case LVAL_SYM: return h ^ lhash_bytes(val->symbol, val->len);
+            case LVAL_STR: return h ^ lhash_bytes(val->str, val->len);
+
+            case LVAL_FUN:
+                if(val->builtin)
+                    return h ^ lhash_mix((unsigned long)val->builtin);
+
+                return h ^ lval_hash(val->formals) ^ lhash_mix(lval_hash(val->body));
+
+            case LVAL_QEXPR:
+            case LVAL_SEXPR:
+                for(int i = 0; i < val->count; i++) {
+                    h = lhash_mix(h ^ lval_hash(val->cell[i]));
+                }
+
+                return h;
+
+            case LVAL_VEC:
+                for(int i = 0; i < val->count; i++) {
+                    h = lhash_mix(h ^ val->data[i]);
+                }
+
+                return h;
+
+            //Combine entries with + so the result doesn't depend on table order
+            case LVAL_HASH:
+                for(int i = 0; i < val->hash->cap; i++) {
+                    if(val->hash->keys[i])
+                        h += lhash_mix(val->hash->hashes[i] ^ lval_hash(val->hash->vals[i]));
+                }
+
+                return h;
+
+            case LVAL_DICT:
+                return h + lhamt_hash(val->dict);
+
+            case LVAL_THREAD:
+                return h ^ lhash_mix((unsigned long)val->thread);
+
+            case LVAL_FUTURE:
+                return h ^ lhash_mix((unsigned long)val->future);
+
+            case LVAL_ISOLATE:
+                return h ^ lhash_mix((unsigned long)val->isolate);
+
+            case LVAL_SEQ:
+                return h ^ lhash_mix((unsigned long)val->seq);
+
+            case LVAL_FILE:
+                return h ^ lhash_mix((unsigned long)val->stream);
+        }
+
+        return h;
+    }
+
+    lhash* lhash_new(int cap) {
+        lhash* table = malloc(sizeof(lhash));
+
+        table->refs = 1;
+        table->count = 0;
+        table->cap = cap;
+        table->hashes = malloc(sizeof(unsigned long) * cap);
+        table->keys = calloc(cap, sizeof(lval*));
+        table->vals = calloc(cap, sizeof(lval*));
+
+        return table;
+    }
+
+    void lhash_del(lhash* table) {
+        if(LREF_DEC(table->refs) > 0)
+            return;
+
+        for(int i = 0; i < table->cap; i++) {
+            if(table->keys[i]) {
+                lval_del(table->keys[i]);
+                lval_del(table->vals[i]);
+            }
+        }
+
+        free(table->hashes);
+        free(table->keys);
+        free(table->vals);
+        free(table);
+    }
+
+    lhash* lhash_cpy(lhash* table) {
+        lhash* cpy = lhash_new(table->cap);
+
+        lstats.copyBytes += sizeof(lhash) + (sizeof(unsigned long) + 2 * sizeof(lval*)) * table->cap;
+
+        cpy->count = table->count;
+        memcpy(cpy->hashes, table->hashes, sizeof(unsigned long) * table->cap);
+
+        for(int i = 0; i < table->cap; i++) {
+            if(table->keys[i]) {
+                cpy->keys[i] = lval_cpy(table->keys[i]);
+                cpy->vals[i] = lval_cpy(table->vals[i]);
+            }
+        }
+
+        return cpy;
+    }
+
+    //Give map a table of its own before changing it, copying it if shared
+    lhash* lhash_own(lval* map) {
+        if(__atomic_load_n(&map->hash->refs, __ATOMIC_ACQUIRE) > 1) {
+            lhash* cpy = lhash_cpy(map->hash);
+            lhash_del(map->hash);
+            map->hash = cpy;
+        }
+
+        return map->hash;
+    }
+
+    //Returns the slot holding key, or -1 if it isn't present
+    int lhash_find(lhash* table, lval* key, unsigned long hash) {
+        int mask = table->cap - 1;
+
+        for(int i = hash & mask; table->keys[i]; i = (i + 1) & mask) {
+            if(table->hashes[i] == hash && lval_eq(table->keys[i], key))
+                return i;
+        }
+
+        return -1;
+    }
+
+    //Place an entry known not to be present into the first free slot
+    void lhash_insert(lhash* table, unsigned long hash, lval* key, lval* val) {
+        int mask = table->cap - 1;
+        int i = hash & mask;
+
+        while(table->keys[i]) {
+            i = (i + 1) & mask;
+        }
+
+        table->hashes[i] = hash;
+        table->keys[i] = key;
+        table->vals[i] = val;
+        table->count++;
+    }
+
+    //Double the table size and reinsert every entry
+    void lhash_grow(lhash* table) {
+        int oldCap = table->cap;
+        unsigned long* hashes = table->hashes;
+        lval** keys = table->keys;
+        lval** vals = table->vals;
+
+        table->count = 0;
+        table->cap = oldCap * 2;
+        table->hashes = malloc(sizeof(unsigned long) * table->cap);
+        table->keys = calloc(table->cap, sizeof(lval*));
+        table->vals = calloc(table->cap, sizeof(lval*));
+
+        for(int i = 0; i < oldCap; i++) {
+            if(keys[i])
+                lhash_insert(table, hashes[i], keys[i], vals[i]);
+        }
+
+        free(hashes);
+        free(keys);
+        free(vals);
+    }
+
+    //Store val under key, taking ownership of both
+    void lhash_put(lhash* table, lval* key, lval* val) {
+        unsigned long hash = lval_hash(key);
+        int slot = lhash_find(table, key, hash);
+
+        //Replace the value of an existing key
+        if(slot >= 0) {
+            lval_del(key);
+            lval_del(table->vals[slot]);
+            table->vals[slot] = val;
+            return;
+        }
+
+        //Keep the load factor under 3/4
+        if((table->count + 1) * 4 > table->cap * 3)
+            lhash_grow(table);
+
+        lhash_insert(table, hash, key, val);
+    }
+
+    //Remove key if present. Later entries in the probe run are shifted back
+    //into the hole so lookups never need tombstones.
+    void lhash_remove(lhash* table, lval* key) {
+        int slot = lhash_find(table, key, lval_hash(key));
+
+        if(slot < 0)
+            return;
+
+        lval_del(table->keys[slot]);
+        lval_del(table->vals[slot]);
+        table->count--;
+
+        int mask = table->cap - 1;
+        int hole = slot;
+
+        for(int i = (slot + 1) & mask; table->keys[i]; i = (i + 1) & mask) {
+            int home = table->hashes[i] & mask;
+
+            //Move the entry if the hole lies between its home slot and i
+            if(((i - home) & mask) >= ((i - hole) & mask)) {
+                table->hashes[hole] = table->hashes[i];
+                table->keys[hole] = table->keys[i];
+                table->vals[hole] = table->vals[i];
+                hole = i;
+            }
+        }
+
+        table->keys[hole] = NULL;
+    }
+
+/* Persistent Maps */
+    lhamt* lhamt_branch(unsigned int bitmap, int count) {
+        lhamt* node = malloc(sizeof(lhamt));
+
+        node->refs = 1;
+        node->leaf = 0;
+        node->count = count;
+        node->bitmap = bitmap;
+        node->children = malloc(sizeof(lhamt*) * count);
+
+        return node;
+    }
+
+    lhamt* lhamt_leaf(unsigned long hash, int count) {
+        lhamt* node = malloc(sizeof(lhamt));
+
+        node->refs = 1;
+        node->leaf = 1;
+        node->count = count;
+        node->hash = hash;
+        node->keys = malloc(sizeof(lval*) * count);
+        node->vals = malloc(sizeof(lval*) * count);
+
+        return node;
+    }
+
+    //Drop a reference, freeing the node and its contents with the last one
+    void lhamt_release(lhamt* node) {
+        if(!node || LREF_DEC(node->refs) > 0)
+            return;
+
+        for(int i = 0; i < node->count; i++) {
+            if(node->leaf) {
+                lval_del(node->keys[i]);
+                lval_del(node->vals[i]);
+            } else {
+                lhamt_release(node->children[i]);
+            }
+        }
+
+        if(node->leaf) {
+            free(node->keys);
+            free(node->vals);
+        } else {
+            free(node->children);
+        }
+
+        free(node);
+    }
+
+    //Position of the child for hash at this level, and whether it exists
+    unsigned int lhamt_bit(unsigned long hash, int shift) {
+        return 1u << ((hash >> shift) & 31);
+    }
+
+    int lhamt_index(lhamt* node, unsigned int bit) {
+        return __builtin_popcount(node->bitmap & (bit - 1));
+    }
+
+    //Returns the value stored for key without copying it, or NULL
+    lval* lhamt_get(lhamt* node, unsigned long hash, lval* key) {
+        for(int shift = 0; node; shift += 5) {
+            if(node->leaf) {
+                if(node->hash != hash)
+                    return NULL;
+
+                for(int i = 0; i < node->count; i++) {
+                    if(lval_eq(node->keys[i], key))
+                        return node->vals[i];
+                }
+
+                return NULL;
+            }
+
+            unsigned int bit = lhamt_bit(hash, shift);
+
+            if(!(node->bitmap & bit))
+                return NULL;
+
+            node = node->children[lhamt_index(node, bit)];
+        }
+
+        return NULL;
+    }
+
+    //Returns a new trie with key set to val, sharing every node off the
+    //path to the key with the original. Takes ownership of key and val and
+    //sets *added if the key was not already present.
+    lhamt* lhamt_assoc(lhamt* node, int shift, unsigned long hash, lval* key, lval* val, int* added) {
+        if(!node) {
+            lhamt* leaf = lhamt_leaf(hash, 1);
+            leaf->keys[0] = key;
+            leaf->vals[0] = val;
+            *added = 1;
+
+            return leaf;
+        }
+
+        if(node->leaf && node->hash == hash) {
+            //Copy the leaf, replacing the matching key or appending to it
+            int slot = node->count;
+
+            for(int i = 0; i < node->count; i++) {
+                if(lval_eq(node->keys[i], key)) slot = i;
+            }
+
+            lhamt* leaf = lhamt_leaf(hash, node->count + (slot == node->count));
+
+            for(int i = 0; i < node->count; i++) {
+                if(i == slot) continue;
+
+                leaf->keys[i] = lval_cpy(node->keys[i]);
+                leaf->vals[i] = lval_cpy(node->vals[i]);
+            }
+
+            leaf->keys[slot] = key;
+            leaf->vals[slot] = val;
+            *added = (slot == node->count);
+
+            return leaf;
+        }
+
+        if(node->leaf) {
+            //Hashes differ, so push the existing leaf down under a new branch
+            lhamt* branch = lhamt_branch(lhamt_bit(node->hash, shift), 1);
+            branch->children[0] = node;
+            LREF_INC(node->refs);
+
+            lhamt* result = lhamt_assoc(branch, shift, hash, key, val, added);
+            lhamt_release(branch);
+
+            return result;
+        }
+
+        unsigned int bit = lhamt_bit(hash, shift);
+        int index = lhamt_index(node, bit);
+        int exists = (node->bitmap & bit) != 0;
+
+        lhamt* branch = lhamt_branch(node->bitmap | bit, node->count + !exists);
+
+        //Share the untouched children
+        for(int i = 0, j = 0; i < branch->count; i++) {
+            if(i == index) {
+                if(exists) j++;
+                continue;
+            }
+
+            branch->children[i] = node->children[j++];
+            LREF_INC(branch->children[i]->refs);
+        }
+
+        branch->children[index] = lhamt_assoc(exists ? node->children[index] : NULL, shift + 5, hash, key, val, added);
+
+        return branch;
+    }
+
+    //Returns a new reference to a trie without key. Sets *removed if the key
+    //was present; otherwise the result is the original node.
+    lhamt* lhamt_dissoc(lhamt* node, int shift, unsigned long hash, lval* key, int* removed) {
+        if(!node)
+            return NULL;
+
+        if(node->leaf) {
+            int slot = -1;
+
+            if(node->hash == hash) {
+                for(int i = 0; i < node->count; i++) {
+                    if(lval_eq(node->keys[i], key)) slot = i;
+                }
+            }
+
+            if(slot < 0) {
+                LREF_INC(node->refs);
+                return node;
+            }
+
+            *removed = 1;
+
+            if(node->count == 1)
+                return NULL;
+
+            lhamt* leaf = lhamt_leaf(hash, node->count - 1);
+
+            for(int i = 0, j = 0; i < node->count; i++) {
+                if(i == slot) continue;
+
+                leaf->keys[j] = lval_cpy(node->keys[i]);
+                leaf->vals[j++] = lval_cpy(node->vals[i]);
+            }
+
+            return leaf;
+        }
+
+        unsigned int bit = lhamt_bit(hash, shift);
+
+        if(!(node->bitmap & bit)) {
+            LREF_INC(node->refs);
+            return node;
+        }
+
+        int index = lhamt_index(node, bit);
+        lhamt* child = lhamt_dissoc(node->children[index], shift + 5, hash, key, removed);
+
+        if(!*removed) {
+            lhamt_release(child);
+            LREF_INC(node->refs);
+            return node;
+        }
+
+        //Collapse branches left holding a single leaf
+        if(!child && node->count == 1)
+            return NULL;
+
+        if(!child && node->count == 2 && node->children[!index]->leaf) {
+            LREF_INC(node->children[!index]->refs);
+            return node->children[!index];
+        }
+
+        lhamt* branch = lhamt_branch(child ? node->bitmap : node->bitmap & ~bit, node->count - !child);
+
+        for(int i = 0, j = 0; i < node->count; i++) {
+            if(i == index) {
+                if(child) branch->children[j++] = child;
+                continue;
+            }
+
+            branch->children[j] = node->children[i];
+            LREF_INC(branch->children[j++]->refs);
+        }
+
+        return branch;
+    }
+
+    //Append copies of the keys, or {key value} pairs, under node to list
+    void lhamt_collect(lhamt* node, lval* list, int pairs) {
+        if(!node)
+            return;
+
+        for(int i = 0; i < node->count; i++) {
+            if(!node->leaf) {
+                lhamt_collect(node->children[i], list, pairs);
+            } else if(pairs) {
+                lval* pair = lval_add(lval_qexpr(), lval_cpy(node->keys[i]));
+                lval_add(list, lval_add(pair, lval_cpy(node->vals[i])));
+            } else {
+                lval_add(list, lval_cpy(node->keys[i]));
+            }
+        }
+    }
+
+/* Memoization */
+    //Cache of argument lists to results for a function wrapped by memo. The
+    //entries are chained per bucket and also kept on a list in order of use,
+    //most recent first, so the least recently used can be evicted when a
+    //capacity is set.
+    typedef struct lmemo_entry {
+        unsigned long hash;
+        lval* args;
+        lval* result;
+
+        struct lmemo_entry* chain;
+        struct lmemo_entry* prev;
+        struct lmemo_entry* next;
+    } lmemo_entry;
+
+    struct lmemo {
+        int refs;
+        pthread_mutex_t lock;
+        long capacity;
+        long count;
+        long hits;
+        long misses;
+        long evictions;
+
+        int buckets;
+        lmemo_entry** table;
+        lmemo_entry* newest;
+        lmemo_entry* oldest;
+    };
+
+    //Create a cache holding at most capacity results, or any number for 0
+    lmemo* lmemo_new(long capacity) {
+        lmemo* memo = calloc(1, sizeof(lmemo));
+
+        memo->refs = 1;
+        pthread_mutex_init(&memo->lock, NULL);
+        memo->capacity = capacity;
+        memo->buckets = 64;
+        memo->table = calloc(memo->buckets, sizeof(lmemo_entry*));
+
+        return memo;
+    }
+
+    void lmemo_release(lmemo* memo) {
+        if(LREF_DEC(memo->refs) > 0)
+            return;
+
+        for(lmemo_entry* entry = memo->newest; entry;) {
+            lmemo_entry* next = entry->next;
+
+            lval_del(entry->args);
+            lval_del(entry->result);
+            free(entry);
+
+            entry = next;
+        }
+
+        pthread_mutex_destroy(&memo->lock);
+        free(memo->table);
+        free(memo);
+    }
+
+    void lmemo_unlink(lmemo* memo, lmemo_entry* entry) {
+        if(entry->prev) entry->prev->next = entry->next;
+        else memo->newest = entry->next;
+
+        if(entry->next) entry->next->prev = entry->prev;
+        else memo->oldest = entry->prev;
+    }
+
+    void lmemo_push(lmemo* memo, lmemo_entry* entry) {
+        entry->prev = NULL;
+        entry->next = memo->newest;
+
+        if(memo->newest) memo->newest->prev = entry;
+        else memo->oldest = entry;
+
+        memo->newest = entry;
+    }
+
+    //Double the buckets once the chains average two entries
+    void lmemo_grow(lmemo* memo) {
+        int buckets = memo->buckets * 2;
+        lmemo_entry** table = calloc(buckets, sizeof(lmemo_entry*));
+
+        for(lmemo_entry* entry = memo->newest; entry; entry = entry->next) {
+            entry->chain = table[entry->hash & (buckets - 1)];
+            table[entry->hash & (buckets - 1)] = entry;
+        }
+
+        free(memo->table);
+        memo->table = table;
+        memo->buckets = buckets;
+    }
+
+    //Drop the least recently used entry
+    void lmemo_evict(lmemo* memo) {
+        lmemo_entry* entry = memo->oldest;
+        lmemo_entry** link = &memo->table[entry->hash & (memo->buckets - 1)];
+
+        while(*link != entry) {
+            link = &(*link)->chain;
+        }
+
+        *link = entry->chain;
+        lmemo_unlink(memo, entry);
+
+        lval_del(entry->args);
+        lval_del(entry->result);
+        free(entry);
+
+        memo->count--;
+        memo->evictions++;
+    }
+
+    lmemo_entry* lmemo_find(lmemo* memo, unsigned long hash, lval* args) {
+        for(lmemo_entry* entry = memo->table[hash & (memo->buckets - 1)]; entry; entry = entry->chain) {
+            if(entry->hash == hash && lval_eq(entry->args, args))
+                return entry;
+        }
+
+        return NULL;
+    }
+
+    //Call a memoized function, returning a copy of the cached result for an
+    //equal argument list. Errors are passed through and never cached. The
+    //cache may be shared with other threads, but its lock isn't held while
+    //the function runs.
+    lval* lmemo_call(lenv* env, lval* func, lval* args) {
+        lmemo* memo = func->memo;
+        unsigned long hash = lval_hash(args);
+
+        pthread_mutex_lock(&memo->lock);
+        lmemo_entry* entry = lmemo_find(memo, hash, args);
+
+        if(entry) {
+            memo->hits++;
+
+            lmemo_unlink(memo, entry);
+            lmemo_push(memo, entry);
+
+            lval* result = lval_cpy(entry->result);
+            pthread_mutex_unlock(&memo->lock);
+            lval_del(args);
+
+            return result;
+        }
+
+        memo->misses++;
+        pthread_mutex_unlock(&memo->lock);
+
+        //Call through with the cache detached, keeping a copy of the key
+        lval* key = lval_cpy(args);
+
+        func->memo = NULL;
+        lval* result = lval_call(env, func, args);
+        func->memo = memo;
+
+        if(result->type == LVAL_ERR) {
+            lval_del(key);
+            return result;
+        }
+
+        pthread_mutex_lock(&memo->lock);
+
+        //Another thread may have cached the same call meanwhile
+        if(lmemo_find(memo, hash, key)) {
+            pthread_mutex_unlock(&memo->lock);
+            lval_del(key);
+
+            return result;
+        }
+
+        entry = malloc(sizeof(lmemo_entry));
+        entry->hash = hash;
+        entry->args = key;
+        entry->result = lval_cpy(result);
+        entry->chain = memo->table[hash & (memo->buckets - 1)];
+        memo->table[hash & (memo->buckets - 1)] = entry;
+        lmemo_push(memo, entry);
+        memo->count++;
+
+        if(memo->capacity && memo->count > memo->capacity)
+            lmemo_evict(memo);
+
+        if(memo->count > memo->buckets * 2)
+            lmemo_grow(memo);
+
+        pthread_mutex_unlock(&memo->lock);
+
+        return result;
+    }
+
+    lval* builtin_cmp(lenv* env, lval* args, char* op) {
+        LASSERT_NUM(op, args, 2);
+
+        int cmpResult = 0;
+
+        if(strcmp(op, "==") == 0) {
+            cmpResult = lval_eq(args->cell[0], args->cell[1]);
+        }
+
+        if(strcmp(op, "!=") == 0) {
+            cmpResult = !lval_eq(args->cell[0], args->cell[1]);
+        }
+
+        lval_del(args);
+
+        return lval_num(cmpResult);
+    }
+
+    lval* builtin_eq(lenv* env, lval* args) {
+        return builtin_cmp(env, args, "==");
+    }
+
+    lval* builtin_ne(lenv* env, lval* args) {
+        return builtin_cmp(env, args, "!=");
+    }
+
+/* Special Forms */
+    //Special forms are handed their arguments unevaluated, borrowed from
+    //the expression they're in, and evaluate only what they need. Code
+    //arguments are Q-Expressions, written in place or given by an
+    //expression. Called through a function value, as by unpack, they get
+    //arguments that are already values, which evaluate to themselves.
+    typedef lval*(*lform)(lenv*, lval**, int);
+
+    lval* lform_type_err(char* func, int index, lval* val, int expect) {
+        lval* err = lval_err("Function '%s' passed incorrect type for argument %i. Got %s, Expected %s.", func, index, ltype_name(val->type), ltype_name(expect));
+        lval_del(val);
+
+        return err;
+    }
+
+    //Evaluates args[index] to a Q-Expression, or returns an error
+    lval* lform_qexpr(lenv* env, char* func, lval** args, int index) {
+        lval* val = lval_eval_ref(env, args[index]);
+
+        if(val->type == LVAL_ERR || val->type == LVAL_QEXPR)
+            return val;
+
+        return lform_type_err(func, index, val, LVAL_QEXPR);
+    }
+
+    //Evaluates the code in args[index]
+    lval* lform_code(lenv* env, char* func, lval** args, int index) {
+        if(args[index]->type == LVAL_QEXPR)
+            return lval_eval_sexpr_ref(env, args[index]);
+
+        lval* code = lform_qexpr(env, func, args, index);
+
+        if(code->type == LVAL_ERR)
+            return code;
+
+        lval* result = lval_eval_sexpr_ref(env, code);
+        lval_del(code);
+
+        return result;
+    }
+
+    lval* lform_if(lenv* env, lval** args, int count) {
+        if(count != 3)
+            return lval_err("Function '%s' passed incorrect number of arguments. Got %i, Expected %i.", "if", count, 3);
+
+        lval* cond = lval_eval_ref(env, args[0]);
+
+        if(cond->type == LVAL_ERR)
+            return cond;
+
+        if(cond->type != LVAL_NUM)
+            return lform_type_err("if", 0, cond, LVAL_NUM);
+
+        //Only the branch taken is evaluated
+        int branch = cond->num ? 1 : 2;
+        lval_del(cond);
+
+        return lform_code(env, "if", args, branch);
+    }
+
+    //Evaluates each argument in turn, giving the last value or {} for none
+    lval* lform_do(lenv* env, lval** args, int count) {
+        lval* result = lval_qexpr();
+
+        for(int i = 0; i < count; i++) {
+            lval_del(result);
+            result = lval_eval_ref(env, args[i]);
+
+            if(result->type == LVAL_ERR)
+                return result;
+        }
+
+        return result;
+    }
+
+    //Evaluates code in a new scope, so = inside it doesn't leak out
+    lval* lform_let(lenv* env, lval** args, int count) {
+        if(count != 1)
+            return lval_err("Function '%s' passed incorrect number of arguments. Got %i, Expected %i.", "let", count, 1);
+
+        lenv* scope = lenv_new();
+        scope->parent = env;
+        scope->root = env->root;
+
+        lval* result = lform_code(scope, "let", args, 0);
+        lenv_del(scope);
+
+        return result;
+    }
+
+    //Finds the first clause {test result} whose test passes and evaluates
+    //its result. With a key, the test is equality with the key, otherwise
+    //it's a number that isn't 0.
+    lval* lform_clauses(lenv* env, char* func, lval* key, lval** args, int count) {
+        for(int i = 0; i < count; i++) {
+            lval* clause = lform_qexpr(env, func, args, i);
+
+            if(clause->type == LVAL_ERR)
+                return clause;
+
+            if(clause->count < 2) {
+                lval_del(clause);
+                return lval_err("Function '%s' passed a clause without a test and a result.", func);
+            }
+
+            lval* test = lval_eval_ref(env, clause->cell[0]);
+
+            if(test->type == LVAL_ERR) {
+                lval_del(clause);
+                return test;
+            }
+
+            if(!key && test->type != LVAL_NUM) {
+                lval_del(clause);
+                return lform_type_err(func, i, test, LVAL_NUM);
+            }
+
+            int passed = key ? lval_eq(key, test) : test->num != 0;
+            lval_del(test);
+
+            if(passed) {
+                lval* result = lval_eval_ref(env, clause->cell[1]);
+                lval_del(clause);
+
+                return result;
+            }
+
+            lval_del(clause);
+        }
+
+        return NULL;
+    }
+
+    lval* lform_select(lenv* env, lval** args, int count) {
+        lval* result = lform_clauses(env, "select", NULL, args, count);
+
+        return result ? result : lval_err("No Selection Found");
+    }
+
+    lval* lform_case(lenv* env, lval** args, int count) {
+        if(count == 0)
+            return lval_err("No Case Found");
+
+        lval* key = lval_eval_ref(env, args[0]);
+
+        if(key->type == LVAL_ERR)
+            return key;
+
+        lval* result = lform_clauses(env, "case", key, args + 1, count - 1);
+        lval_del(key);
+
+        return result ? result : lval_err("No Case Found");
+    }
+
+    //Evaluates numbers until one is 0 for and, or isn't 0 for or
+    lval* lform_logic(lenv* env, char* func, lval** args, int count, int stop) {
+        for(int i = 0; i < count; i++) {
+            lval* val = lval_eval_ref(env, args[i]);
+
+            if(val->type == LVAL_ERR)
+                return val;
+
+            if(val->type != LVAL_NUM)
+                return lform_type_err(func, i, val, LVAL_NUM);
+
+            int truth = val->num != 0;
+            lval_del(val);
+
+            if(truth == stop)
+                return lval_num(stop);
+        }
+
+        return lval_num(!stop);
+    }
+
+    lval* lform_and(lenv* env, lval** args, int count) {
+        return lform_logic(env, "and", args, count, 0);
+    }
+
+    lval* lform_or(lenv* env, lval** args, int count) {
+        return lform_logic(env, "or", args, count, 1);
+    }
+
+    //The builtins that name each form, for calls with evaluated arguments
+    lval* builtin_if(lenv* env, lval* args) {
+        lval* result = lform_if(env, args->cell, args->count);
+        lval_del(args);
+
+        return result;
+    }
+
+    lval* builtin_do(lenv* env, lval* args) {
+        lval* result = lform_do(env, args->cell, args->count);
+        lval_del(args);
+
+        return result;
+    }
+
+    lval* builtin_let(lenv* env, lval* args) {
+        lval* result = lform_let(env, args->cell, args->count);
+        lval_del(args);
+
+        return result;
+    }
+
+    lval* builtin_select(lenv* env, lval* args) {
+        lval* result = lform_select(env, args->cell, args->count);
+        lval_del(args);
+
+        return result;
+    }
+
+    lval* builtin_case(lenv* env, lval* args) {
+        lval* result = lform_case(env, args->cell, args->count);
+        lval_del(args);
+
+        return result;
+    }
+
+    lval* builtin_and(lenv* env, lval* args) {
+        lval* result = lform_and(env, args->cell, args->count);
+        lval_del(args);
+
+        return result;
+    }
+
+    lval* builtin_or(lenv* env, lval* args) {
+        lval* result = lform_or(env, args->cell, args->count);
+        lval_del(args);
+
+        return result;
+    }
+
+    typedef struct {
+        lbuiltin builtin;
+        lform form;
+    } lform_entry;
+
+    lform_entry lforms[] = {
+        { builtin_if, lform_if },
+        { builtin_do, lform_do },
+        { builtin_let, lform_let },
+        { builtin_select, lform_select },
+        { builtin_case, lform_case },
+        { builtin_and, lform_and },
+        { builtin_or, lform_or },
+    };
+
+    //The special form a function value stands for, if any
+    lform lform_of(lval* func) {
+        if(func->type != LVAL_FUN || !func->builtin || func->memo)
+            return NULL;
+
+        for(size_t i = 0; i < sizeof(lforms) / sizeof(lforms[0]); i++) {
+            if(lforms[i].builtin == func->builtin)
+                return lforms[i].form;
+        }
+
+        return NULL;
+    }
+
+/* Optimizer */
+    //Set by --optimize. The body of each lambda is then simplified when the
+    //lambda is made: nil, true and false are replaced by their value, calls
+    //of arithmetic and comparison builtins on constants are replaced by
+    //their result, and an if whose condition is constant is replaced by the
+    //branch it takes. Scoping is dynamic, so only names that can't be bound
+    //to anything else are relied on. Those are reserved: the builtins and
+    //the atoms stdlib.dlsp defines first are pinned from the start, after
+    //which a def or = giving one a different value, or a lambda taking one
+    //as a parameter, is an error.
+    int lopt_enabled = 0;
+
+    //Builtins whose result depends on nothing but their arguments
+    int lopt_pure(lbuiltin func) {
+        return func == builtin_add || func == builtin_sub || func == builtin_mult
+            || func == builtin_div || func == builtin_pow || func == builtin_mod
+            || func == builtin_eq || func == builtin_ne || func == builtin_gt
+            || func == builtin_lt || func == builtin_gte || func == builtin_lte;
+    }
+
+    int lopt_constant(lval* val) {
+        return val->type == LVAL_NUM || val->type == LVAL_STR || val->type == LVAL_QEXPR;
+    }
+
+    int lopt_reserved(lval* sym) {
+        return __atomic_load_n(&sym->name->pinned, __ATOMIC_RELAXED);
+    }
+
+    //Reserve a name before anything is defined, if optimizing
+    void lopt_reserve(char* name) {
+        if(!lopt_enabled)
+            return;
+
+        lval* sym = lval_sym(name);
+        __atomic_store_n(&sym->name->pinned, 1, __ATOMIC_RELAXED);
+        lval_del(sym);
+    }
+
+    //The global value of a symbol if the optimizer may rely on it, or NULL
+    lval* lopt_global(lenv* env, lval* sym) {
+        if(sym->type != LVAL_SYM || !env->root->lock || !lopt_reserved(sym))
+            return NULL;
+
+        lval* val = lenv_get_global(env->root, sym);
+
+        if(val->type == LVAL_ERR) {
+            lval_del(val);
+            return NULL;
+        }
+
+        return val;
+    }
+
+    lval* lopt_form(lenv* env, lval* form);
+
+    //Simplify an expression that will be evaluated, returning what to
+    //evaluate in its place
+    lval* lopt_expr(lenv* env, lval* val) {
+        if(val->type == LVAL_SEXPR)
+            return lopt_form(env, val);
+
+        lval* global = lopt_global(env, val);
+
+        if(!global)
+            return val;
+
+        if(global->type == LVAL_NUM || (global->type == LVAL_QEXPR && global->count == 0)) {
+            lval_del(val);
+
+            return global;
+        }
+
+        lval_del(global);
+
+        return val;
+    }
+
+    //Simplify a branch of an if, which is evaluated as an S-Expression
+    lval* lopt_branch(lenv* env, lval* branch) {
+        lval* result = lopt_form(env, branch);
+
+        if(result == branch)
+            return branch;
+
+        //A branch that became an if's chosen branch is used as it is, any
+        //other value is wrapped back up to evaluate to itself
+        if(result->type == LVAL_SEXPR) {
+            result->type = LVAL_QEXPR;
+            return result;
+        }
+
+        return lval_add(lval_qexpr(), result);
+    }
+
+    //Simplify the cells of an S-Expression, or a body or branch that will
+    //be evaluated as one. Returns form, or what to evaluate in its place.
+    lval* lopt_form(lenv* env, lval* form) {
+        if(form->count == 0)
+            return form;
+
+        lval* func = lopt_global(env, form->cell[0]);
+
+        //Only builtins are looked into
+        if(func && func->type != LVAL_FUN) {
+            lval_del(func);
+            func = NULL;
+        }
+
+        //Both branches of an if are code, not just data
+        if(func && func->builtin == builtin_if && form->count == 4) {
+            form->cell[1] = lopt_expr(env, form->cell[1]);
+
+            for(int i = 2; i < 4; i++) {
+                if(form->cell[i]->type == LVAL_QEXPR)
+                    form->cell[i] = lopt_branch(env, form->cell[i]);
+            }
+
+            lval* cond = form->cell[1];
+
+            //Keep the branch taken, to evaluate as if would
+            if(cond->type == LVAL_NUM && form->cell[cond->num ? 2 : 3]->type == LVAL_QEXPR) {
+                lval* branch = lval_take(form, cond->num ? 2 : 3);
+                branch->type = LVAL_SEXPR;
+
+                lval_del(func);
+                return branch;
+            }
+
+            lval_del(func);
+            return form;
+        }
+
+        for(int i = 1; i < form->count; i++) {
+            form->cell[i] = lopt_expr(env, form->cell[i]);
+        }
+
+        //A pure call with constant arguments is replaced by its result,
+        //unless that's an error, which is left to happen when it's called
+        if(func && func->builtin && !func->memo && lopt_pure(func->builtin) && form->count > 1) {
+            int constant = 1;
+
+            for(int i = 1; i < form->count; i++) {
+                constant = constant && lopt_constant(form->cell[i]);
+            }
+
+            if(constant) {
+                lval* args = lval_sexpr();
+
+                for(int i = 1; i < form->count; i++) {
+                    lval_add(args, lval_cpy(form->cell[i]));
+                }
+
+                lval* result = func->builtin(env, args);
+
+                if(result->type != LVAL_ERR) {
+                    lval_del(func);
+                    lval_del(form);
+
+                    return result;
+                }
+
+                lval_del(result);
+            }
+        }
+
+        if(func)
+            lval_del(func);
+
+        return form;
+    }
+
+    //Simplify the body of a lambda being made in env
+    lval* lopt_body(lenv* env, lval* body) {
+        if(!lopt_enabled)
+            return body;
+
+        //Keep where the body came from for the profiler
+        char* file = body->file;
+        int line = body->line;
+
+        body = lopt_branch(env, body);
+        body->file = file;
+        body->line = line;
+
+        return body;
+    }
+
+    //Check a def or = of sym to val against the values optimized code was
+    //built with. Returns an error if it would change one, otherwise NULL.
+    lval* lopt_redefine(lenv* env, lval* sym, lval* val) {
+        if(!__atomic_load_n(&sym->name->pinned, __ATOMIC_RELAXED))
+            return NULL;
+
+        //Pins are shared by every global env, so a first definition, such
+        //as stdlib.dlsp defining the atoms, is fine
+        lval* old = lenv_get_global(env->root, sym);
+        int same = old->type == LVAL_ERR || lval_eq(old, val);
+        lval_del(old);
+
+        if(same)
+            return NULL;
+
+        return lval_err("Cannot redefine '%s', optimized functions rely on its value", sym->symbol);
+    }
+
+/* Serialization */
+    //Values are written as a type byte followed by their contents, with
+    //numbers and lengths as zigzag varints, 7 bits to a byte, and vector
+    //elements as they are in memory. Builtins are written by
+    //name. Lambdas keep their formals, body and bound arguments but lose
+    //any memo cache and the file they came from. Isolate handles can only
+    //be written for reading back in the same process, as a pointer that
+    //carries a reference, so they are read from messages but never files.
+    typedef struct {
+        char* data;
+        long len;
+        long cap;
+
+        //Whether handles may be written, and the type that stopped a write
+        int local;
+        int bad;
+
+        //Total bytes of string contents written
+        long strings;
+    } lwire;
+
+    typedef struct {
+        char* pos;
+        char* end;
+
+        //If set, strings are read into this buffer rather than one each
+        lbuf* strings;
+
+        //Whether handles may be read, which only messages within the process carry
+        int local;
+    } lwire_in;
+
+    void lwire_put(lwire* out, void* bytes, long n) {
+        if(out->len + n > out->cap) {
+            out->cap = (out->len + n) * 2;
+            out->data = realloc(out->data, out->cap);
+        }
+
+        memcpy(out->data + out->len, bytes, n);
+        out->len += n;
+    }
+
+    void lwire_long(lwire* out, long x) {
+        unsigned long z = ((unsigned long)x << 1) ^ (unsigned long)(x >> (sizeof(long) * 8 - 1));
+        char bytes[10];
+        int n = 0;
+
+        while(z >= 0x80) {
+            bytes[n++] = (z & 0x7f) | 0x80;
+            z >>= 7;
+        }
+
+        bytes[n++] = z;
+        lwire_put(out, bytes, n);
+    }
+
+    void lwire_bytes(lwire* out, char* bytes, long n) {
+        lwire_long(out, n);
+        lwire_put(out, bytes, n);
+    }
+
+    //Returns n bytes of input, or NULL past the end
+    char* lwire_get(lwire_in* in, long n) {
+        if(n < 0 || n > in->end - in->pos)
+            return NULL;
+
+        char* bytes = in->pos;
+        in->pos += n;
+
+        return bytes;
+    }
+
+    int lwire_get_long(lwire_in* in, long* x) {
+        unsigned long z = 0;
+
+        for(int shift = 0; shift < (int)sizeof(long) * 8 && in->pos < in->end; shift += 7) {
+            unsigned char byte = *in->pos++;
+            z |= (unsigned long)(byte & 0x7f) << shift;
+
+            if(!(byte & 0x80)) {
+                *x = (long)(z >> 1) ^ -(long)(z & 1);
+                return 1;
+            }
+        }
+
+        return 0;
+    }
+
+    char* lwire_get_bytes(lwire_in* in, long* n) {
+        return lwire_get_long(in, n) ? lwire_get(in, *n) : NULL;
+    }
+
+    int lser_write(lwire* out, lval* val);
+
+    int lser_write_hamt(lwire* out, lhamt* node) {
+        if(!node)
+            return 1;
+
+        for(int i = 0; i < node->count; i++) {
+            if(!node->leaf) {
+                if(!lser_write_hamt(out, node->children[i]))
+                    return 0;
+            } else if(!lser_write(out, node->keys[i]) || !lser_write(out, node->vals[i])) {
+                return 0;
+            }
+        }
+
+        return 1;
+    }
+
+    //Append val to out, returning 0 and setting bad if it holds a type that
+    //can't be written
+    int lser_write(lwire* out, lval* val) {
+        char type = val->type;
+        lwire_put(out, &type, 1);
+
+        switch(val->type) {
+            case LVAL_NUM:
+                lwire_long(out, val->num);
+                return 1;
+
+            case LVAL_ERR: lwire_bytes(out, val->err, val->len); return 1;
+            case LVAL_SYM: lwire_bytes(out, val->symbol, val->len); return 1;
+            case LVAL_STR:
+                lwire_bytes(out, val->str, val->len);
+                out->strings += val->len;
+                return 1;
+
+            case LVAL_SEXPR:
+            case LVAL_QEXPR:
+                lwire_long(out, val->count);
+
+                for(int i = 0; i < val->count; i++) {
+                    if(!lser_write(out, val->cell[i]))
+                        return 0;
+                }
+
+                return 1;
+
+            case LVAL_FUN: {
+                char builtin = val->builtin != NULL;
+                lwire_put(out, &builtin, 1);
+
+                if(builtin) {
+                    char* name = lstats_builtins[lstats_builtin_slot(val->builtin)].name;
+                    lwire_bytes(out, name, strlen(name));
+                    return 1;
+                }
+
+                if(!lser_write(out, val->formals) || !lser_write(out, val->body))
+                    return 0;
+
+                //Arguments bound by partial application
+                lwire_long(out, val->env->count);
+
+                for(int i = 0; i < val->env->count; i++) {
+                    lwire_bytes(out, val->env->symbols[i], val->env->lens[i]);
+
+                    if(!lser_write(out, val->env->vals[i]))
+                        return 0;
+                }
+
+                return 1;
+            }
+
+            case LVAL_VEC:
+                lwire_long(out, val->count);
+                lwire_put(out, val->data, sizeof(long) * val->count);
+                return 1;
+
+            case LVAL_HASH:
+                lwire_long(out, val->hash->count);
+
+                for(int i = 0; i < val->hash->cap; i++) {
+                    if(!val->hash->keys[i])
+                        continue;
+
+                    if(!lser_write(out, val->hash->keys[i]) || !lser_write(out, val->hash->vals[i]))
+                        return 0;
+                }
+
+                return 1;
+
+            case LVAL_DICT:
+                lwire_long(out, val->count);
+                return lser_write_hamt(out, val->dict);
+
+            case LVAL_ISOLATE:
+                if(!out->local)
+                    break;
+
+                lisolate_retain(val->isolate);
+                lwire_put(out, &val->isolate, sizeof(lisolate*));
+                return 1;
+        }
+
+        out->bad = val->type;
+
+        return 0;
+    }
+
+    //Returns the builtin first registered under name, or NULL
+    lbuiltin lser_builtin(char* name, long len) {
+        for(int i = 0; i < LSTATS_BUILTINS; i++) {
+            char* reg = lstats_builtins[i].name;
+
+            if(reg && (long)strlen(reg) == len && memcmp(reg, name, len) == 0)
+                return lstats_builtins[i].func;
+        }
+
+        return NULL;
+    }
+
+    //Read a value written by lser_write, or NULL if the input is malformed
+    lval* lser_read(lwire_in* in) {
+        char* type = lwire_get(in, 1);
+        char* bytes;
+        long n;
+
+        if(!type)
+            return NULL;
+
+        switch(*type) {
+            case LVAL_NUM:
+                return lwire_get_long(in, &n) ? lval_num(n) : NULL;
+
+            case LVAL_ERR:
+                bytes = lwire_get_bytes(in, &n);
+                return bytes ? lval_err("%.*s", (int)n, bytes) : NULL;
+
+            case LVAL_SYM:
+                bytes = lwire_get_bytes(in, &n);
+                return bytes ? lval_sym_len(bytes, n) : NULL;
+
+            case LVAL_STR:
+                bytes = lwire_get_bytes(in, &n);
+
+                if(!bytes)
+                    return NULL;
+
+                if(!in->strings || in->strings->used + n > in->strings->cap)
+                    return lval_str_len(bytes, n);
+
+                //Slice the shared buffer instead
+                char* str = in->strings->data + in->strings->used;
+                memcpy(str, bytes, n);
+                in->strings->used += n;
+
+                return lval_slice(in->strings, str, n);
+
+            case LVAL_SEXPR:
+            case LVAL_QEXPR: {
+                if(!lwire_get_long(in, &n) || n < 0 || n > in->end - in->pos)
+                    return NULL;
+
+                lval* list = (*type == LVAL_SEXPR) ? lval_sexpr() : lval_qexpr();
+                list->cell = malloc(sizeof(lval*) * n);
+
+                for(; list->count < n; list->count++) {
+                    lval* item = lser_read(in);
+
+                    if(!item) {
+                        lval_del(list);
+                        return NULL;
+                    }
+
+                    list->cell[list->count] = item;
+                }
+
+                return list;
+            }
+
+            case LVAL_FUN: {
+                char* builtin = lwire_get(in, 1);
+
+                if(!builtin)
+                    return NULL;
+
+                if(*builtin) {
+                    bytes = lwire_get_bytes(in, &n);
+                    lbuiltin func = bytes ? lser_builtin(bytes, n) : NULL;
+
+                    return func ? lval_fun(func) : NULL;
+                }
+
+                lval* formals = lser_read(in);
+                lval* body = formals ? lser_read(in) : NULL;
+
+                if(!body) {
+                    if(formals) lval_del(formals);
+                    return NULL;
+                }
+
+                lval* fun = lval_lambda(formals, body);
+
+                long bound;
+
+                if(!lwire_get_long(in, &bound)) {
+                    lval_del(fun);
+                    return NULL;
+                }
+
+                for(long i = 0; i < bound; i++) {
+                    bytes = lwire_get_bytes(in, &n);
+                    lval* sym = bytes ? lval_sym_len(bytes, n) : NULL;
+                    lval* val = sym ? lser_read(in) : NULL;
+
+                    if(!val) {
+                        if(sym) lval_del(sym);
+                        lval_del(fun);
+                        return NULL;
+                    }
+
+                    lenv_set(fun->env, sym, val);
+                    lval_del(sym);
+                    lval_del(val);
+                }
+
+                return fun;
+            }
+
+            case LVAL_VEC: {
+                if(!lwire_get_long(in, &n) || n < 0 || n > (in->end - in->pos) / (long)sizeof(long))
+                    return NULL;
+
+                lval* vec = lval_vec(n);
+                memcpy(vec->data, lwire_get(in, sizeof(long) * n), sizeof(long) * n);
+
+                return vec;
+            }
+
+            case LVAL_HASH:
+            case LVAL_DICT: {
+                if(!lwire_get_long(in, &n) || n < 0)
+                    return NULL;
+
+                lval* map = (*type == LVAL_HASH) ? lval_hash_map() : lval_dict(NULL, 0);
+
+                for(long i = 0; i < n; i++) {
+                    lval* key = lser_read(in);
+                    lval* val = key ? lser_read(in) : NULL;
+
+                    if(!val) {
+                        if(key) lval_del(key);
+                        lval_del(map);
+                        return NULL;
+                    }
+
+                    if(map->type == LVAL_HASH) {
+                        lhash_put(map->hash, key, val);
+                    } else {
+                        int added = 0;
+                        lhamt* root = lhamt_assoc(map->dict, 0, lval_hash(key), key, val, &added);
+                        lhamt_release(map->dict);
+
+                        map->dict = root;
+                        map->count += added;
+                    }
+                }
+
+                return map;
+            }
+
+            case LVAL_ISOLATE: {
+                bytes = in->local ? lwire_get(in, sizeof(lisolate*)) : NULL;
+
+                if(!bytes)
+                    return NULL;
+
+                lisolate* iso;
+                memcpy(&iso, bytes, sizeof(lisolate*));
+
+                return lval_isolate(iso);
+            }
+        }
+
+        return NULL;
+    }
+
+/* Serialization Builtins */
+    //serialize writes this header and then the value as lser_write lays it
+    //out. deserialize maps the file rather than reading it, and reads every
+    //string into one buffer sized from the header, so loading allocates the
+    //lvals and the list arrays and little else. The strings then keep the
+    //whole buffer alive between them.
+    #define LSER_MAGIC "lispyser"
+    #define LSER_VERSION 1
+    #define LSER_ORDER 0x0102030405060708L
+
+    typedef struct {
+        char magic[8];
+        int version;
+        int wordSize;
+        long order;
+        long strings;
+        long length;
+    } lser_header;
+
+    lval* builtin_serialize(lenv* env, lval* args) {
+        LASSERT_NUM("serialize", args, 2);
+        LASSERT_TYPE("serialize", args, 1, LVAL_STR);
+
+        lwire wire = { NULL, 0, 0, 0, 0, 0 };
+
+        if(!lser_write(&wire, args->cell[0])) {
+            lval* err = lval_err("Function 'serialize' cannot write a %s.", ltype_name(wire.bad));
+
+            free(wire.data);
+            lval_del(args);
+
+            return err;
+        }
+
+        lser_header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, LSER_MAGIC, sizeof(header.magic));
+        header.version = LSER_VERSION;
+        header.wordSize = sizeof(long);
+        header.order = LSER_ORDER;
+        header.strings = wire.strings;
+        header.length = wire.len;
+
+        char* path = lval_cstr(args->cell[1]);
+        FILE* file = fopen(path, "wb");
+        int written = 0;
+
+        if(file) {
+            written = fwrite(&header, sizeof(header), 1, file) == 1
+                && fwrite(wire.data, 1, wire.len, file) == (size_t)wire.len;
+            written = (fclose(file) == 0) && written;
+        }
+
+        lval* result = written ? lval_sexpr() : lval_err("Could not write file %s", path);
+
+        free(path);
+        free(wire.data);
+        lval_del(args);
+
+        return result;
+    }
+
+    lval* builtin_deserialize(lenv* env, lval* args) {
+        LASSERT_NUM("deserialize", args, 1);
+        LASSERT_TYPE("deserialize", args, 0, LVAL_STR);
+
+        char* path = lval_cstr(args->cell[0]);
+        lval_del(args);
+
+        int fd = open(path, O_RDONLY);
+        struct stat st;
+
+        if(fd < 0 || fstat(fd, &st) != 0) {
+            lval* err = lval_err("Could not read file %s", path);
+
+            if(fd >= 0) close(fd);
+            free(path);
+
+            return err;
+        }
+
+        char* map = st.st_size >= (off_t)sizeof(lser_header)
+            ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)
+            : MAP_FAILED;
+
+        close(fd);
+
+        if(map == MAP_FAILED) {
+            lval* err = lval_err("File %s is not a serialized value", path);
+            free(path);
+            return err;
+        }
+
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+        lser_header header;
+        memcpy(&header, map, sizeof(header));
+
+        lval* result = NULL;
+
+        if(memcmp(header.magic, LSER_MAGIC, sizeof(header.magic)) != 0) {
+            result = lval_err("File %s is not a serialized value", path);
+        } else if(header.version != LSER_VERSION) {
+            result = lval_err("File %s is serialization version %i, expected %i", path, header.version, LSER_VERSION);
+        } else if(header.wordSize != sizeof(long) || header.order != LSER_ORDER) {
+            result = lval_err("File %s was serialized on a machine with a different word size or byte order", path);
+        } else if(header.length != st.st_size - (long)sizeof(header) || header.strings < 0 || header.strings > header.length) {
+            result = lval_err("File %s is truncated", path);
+        } else {
+            lwire_in in = { map + sizeof(header), map + st.st_size, lbuf_new(header.strings), 0 };
+
+            result = lser_read(&in);
+
+            if(result && in.pos != in.end) {
+                lval_del(result);
+                result = NULL;
+            }
+
+            lbuf_release(in.strings);
+
+            if(!result)
+                result = lval_err("File %s is corrupt", path);
+        }
+
+        munmap(map, st.st_size);
+        free(path);
+
+        return result;
+    }
+
+/* Vector Builtins */
+    //Convert a Q-Expression of numbers into a packed vector
+    lval* builtin_vec(lenv* env, lval* args) {
+        LASSERT_NUM("vec", args, 1);
+        LASSERT_TYPE("vec", args, 0, LVAL_QEXPR);
+
+        lval* list = args->cell[0];
+
+        for(int i = 0; i < list->count; i++) {
+            LASSERT(args, list->cell[i]->type == LVAL_NUM,
+                "Function 'vec' passed non-number at index %i. Got %s, Expected %s.",
+                i, ltype_name(list->cell[i]->type), ltype_name(LVAL_NUM));
+        }
+
+        lval* vec = lval_vec(list->count);
+
+        for(int i = 0; i < list->count; i++) {
+            vec->data[i] = list->cell[i]->num;
+        }
+
+        lval_del(args);
+
+        return vec;
+    }
+
+    //Convert a vector back into a Q-Expression of numbers
+    lval* builtin_vec_list(lenv* env, lval* args) {
+        LASSERT_NUM("vec-list", args, 1);
+        LASSERT_TYPE("vec-list", args, 0, LVAL_VEC);
+
+        lval* vec = args->cell[0];
+        lval* list = lval_qexpr();
+
+        list->count = vec->count;
+        list->cell = malloc(sizeof(lval*) * list->count);
+
+        for(int i = 0; i < vec->count; i++) {
+            list->cell[i] = lval_num(vec->data[i]);
+        }
+
+        lval_del(args);
+
+        return list;
+    }
+
+    lval* builtin_vec_len(lenv* env, lval* args) {
+        LASSERT_NUM("vec-len", args, 1);
+        LASSERT_TYPE("vec-len", args, 0, LVAL_VEC);
+
+        lval* len = lval_num(args->cell[0]->count);
+        lval_del(args);
+
+        return len;
+    }
+
+    lval* builtin_vec_nth(lenv* env, lval* args) {
+        LASSERT_NUM("vec-nth", args, 2);
+        LASSERT_TYPE("vec-nth", args, 0, LVAL_NUM);
+        LASSERT_TYPE("vec-nth", args, 1, LVAL_VEC);
+
+        long n = args->cell[0]->num;
+        lval* vec = args->cell[1];
+
+        LASSERT(args, n >= 0 && n < vec->count,
+            "Function 'vec-nth' passed index out of range. Got %li, Expected 0 to %i.", n, vec->count - 1);
+
+        lval* item = lval_num(vec->data[n]);
+        lval_del(args);
+
+        return item;
+    }
+
+    //Copy the items from start up to (not including) end
+    lval* builtin_vec_slice(lenv* env, lval* args) {
+        LASSERT_NUM("vec-slice", args, 3);
+        LASSERT_TYPE("vec-slice", args, 0, LVAL_NUM);
+        LASSERT_TYPE("vec-slice", args, 1, LVAL_NUM);
+        LASSERT_TYPE("vec-slice", args, 2, LVAL_VEC);
+
+        long start = args->cell[0]->num;
+        long end = args->cell[1]->num;
+        lval* vec = args->cell[2];
+
+        LASSERT(args, start >= 0 && start <= end && end <= vec->count,
+            "Function 'vec-slice' passed invalid range %li to %li for vector of length %i.", start, end, vec->count);
+
+        lval* slice = lval_vec(end - start);
+        memcpy(slice->data, vec->data + start, sizeof(long) * slice->count);
+
+        lval_del(args);
+
+        return slice;
+    }
+
+    //Elementwise arithmetic on two vectors, or a vector and a number
+    lval* builtin_vec_op(lenv* env, lval* args, char* func) {
+        LASSERT_NUM(func, args, 2);
+
+        lval* x = args->cell[0];
+        lval* y = args->cell[1];
+
+        LASSERT(args, (x->type == LVAL_VEC || x->type == LVAL_NUM) && (y->type == LVAL_VEC || y->type == LVAL_NUM)
+            && (x->type == LVAL_VEC || y->type == LVAL_VEC),
+            "Function '%s' expects a Vector and a Vector or Number. Got %s and %s.",
+            func, ltype_name(x->type), ltype_name(y->type));
+
+        LASSERT(args, x->type != LVAL_VEC || y->type != LVAL_VEC || x->count == y->count,
+            "Function '%s' passed vectors of different lengths. Got %i and %i.", func, x->count, y->count);
+
+        int n = (x->type == LVAL_VEC) ? x->count : y->count;
+        lval* result = lval_vec(n);
+
+        //Broadcast a number argument across the length of the vector
+        long* xs = x->data;
+        long* ys = y->data;
+
+        if(x->type == LVAL_NUM) {
+            xs = malloc(sizeof(long) * n);
+            for(int i = 0; i < n; i++) xs[i] = x->num;
+        }
+
+        if(y->type == LVAL_NUM) {
+            ys = malloc(sizeof(long) * n);
+            for(int i = 0; i < n; i++) ys[i] = y->num;
+        }
+
+        switch(func[3]) {
+            case '+': lvec.add(result->data, xs, ys, n); break;
+            case '-': lvec.sub(result->data, xs, ys, n); break;
+
+            case '*':
+                for(int i = 0; i < n; i++)
+                    result->data[i] = (unsigned long)xs[i] * (unsigned long)ys[i];
+                break;
+
+            case '/':
+                for(int i = 0; i < n; i++) {
+                    if(ys[i] == 0) {
+                        lval_del(result);
+                        result = lval_err("Cannot Divide by Zero!");
+                        break;
+                    }
+
+                    //Dividing the lowest number by -1 overflows, so negate
+                    //instead, wrapping like the other operators
+                    result->data[i] = (ys[i] == -1) ? 0UL - (unsigned long)xs[i] : xs[i] / ys[i];
+                }
+                break;
+        }
+
+        if(x->type == LVAL_NUM) free(xs);
+        if(y->type == LVAL_NUM) free(ys);
+
+        lval_del(args);
+
+        return result;
+    }
+
+    lval* builtin_vec_add(lenv* env, lval* args) {
+        return builtin_vec_op(env, args, "vec+");
+    }
+
+    lval* builtin_vec_sub(lenv* env, lval* args) {
+        return builtin_vec_op(env, args, "vec-");
+    }
+
+    lval* builtin_vec_mult(lenv* env, lval* args) {
+        return builtin_vec_op(env, args, "vec*");
+    }
+
+    lval* builtin_vec_div(lenv* env, lval* args) {
+        return builtin_vec_op(env, args, "vec/");
+    }
+
+    //Reduce a single vector to a number
+    lval* builtin_vec_reduce(lenv* env, lval* args, char* func) {
+        LASSERT_NUM(func, args, 1);
+        LASSERT_TYPE(func, args, 0, LVAL_VEC);
+
+        lval* vec = args->cell[0];
+        long result = 0;
+
+        if(strcmp(func, "vec-sum") == 0) {
+            result = lvec.sum(vec->data, vec->count);
+        } else {
+            LASSERT(args, vec->count != 0, "Function '%s' passed an empty vector.", func);
+
+            if(strcmp(func, "vec-min") == 0)
+                result = lvec.min(vec->data, vec->count);
+            else
+                result = lvec.max(vec->data, vec->count);
+        }
+
+        lval_del(args);
+
+        return lval_num(result);
+    }
+
+    lval* builtin_vec_sum(lenv* env, lval* args) {
+        return builtin_vec_reduce(env, args, "vec-sum");
+    }
+
+    lval* builtin_vec_min(lenv* env, lval* args) {
+        return builtin_vec_reduce(env, args, "vec-min");
+    }
+
+    lval* builtin_vec_max(lenv* env, lval* args) {
+        return builtin_vec_reduce(env, args, "vec-max");
+    }
+
+    lval* builtin_vec_dot(lenv* env, lval* args) {
+        LASSERT_NUM("vec-dot", args, 2);
+        LASSERT_TYPE("vec-dot", args, 0, LVAL_VEC);
+        LASSERT_TYPE("vec-dot", args, 1, LVAL_VEC);
+        LASSERT(args, args->cell[0]->count == args->cell[1]->count,
+            "Function 'vec-dot' passed vectors of different lengths. Got %i and %i.",
+            args->cell[0]->count, args->cell[1]->count);
+
+        long result = lvec.dot(args->cell[0]->data, args->cell[1]->data, args->cell[0]->count);
+        lval_del(args);
+
+        return lval_num(result);
+    }
+
+/* Hash Map Builtins */
+    //Create a map filled from a Q-Expression of {key value} pairs, so
+    //(hash-new {}) is an empty map
+    lval* builtin_hash_new(lenv* env, lval* args) {
+        LASSERT_NUM("hash-new", args, 1);
+        LASSERT_TYPE("hash-new", args, 0, LVAL_QEXPR);
+
+        lval* map = lval_hash_map();
+        lval* pairs = args->cell[0];
+
+        for(int i = 0; i < pairs->count; i++) {
+            if(pairs->cell[i]->type != LVAL_QEXPR || pairs->cell[i]->count != 2) {
+                lval_del(map);
+                lval_del(args);
+
+                return lval_err("Function 'hash-new' expects {key value} pairs. Got invalid pair at index %i.", i);
+            }
+
+            lval* key = lval_pop(pairs->cell[i], 0);
+            lhash_put(map->hash, key, lval_pop(pairs->cell[i], 0));
+        }
+
+        lval_del(args);
+
+        return map;
+    }
+
+    lval* builtin_hash_get(lenv* env, lval* args) {
+        LASSERT(args, args->count == 2 || args->count == 3,
+            "Function 'hash-get' passed incorrect number of arguments. Got %i, Expected 2 or 3.", args->count);
+        LASSERT_TYPE("hash-get", args, 0, LVAL_HASH);
+
+        lhash* table = args->cell[0]->hash;
+        int slot = lhash_find(table, args->cell[1], lval_hash(args->cell[1]));
+
+        //Fall back to the default value if one was given
+        if(slot < 0) {
+            LASSERT(args, args->count == 3, "Function 'hash-get' could not find key.");
+
+            return lval_take(args, 2);
+        }
+
+        //Take the value out of a table nothing else shares rather than copy it
+        lval* val;
+
+        if(__atomic_load_n(&table->refs, __ATOMIC_ACQUIRE) > 1) {
+            val = lval_cpy(table->vals[slot]);
+        } else {
+            val = table->vals[slot];
+            table->vals[slot] = lval_sexpr();
+        }
+
+        lval_del(args);
+
+        return val;
+    }
+
+    lval* builtin_hash_has(lenv* env, lval* args) {
+        LASSERT_NUM("hash-has", args, 2);
+        LASSERT_TYPE("hash-has", args, 0, LVAL_HASH);
+
+        int found = lhash_find(args->cell[0]->hash, args->cell[1], lval_hash(args->cell[1])) >= 0;
+        lval_del(args);
+
+        return lval_num(found);
+    }
+
+    //Maps are values like everything else, so put and del return the new map
+    lval* builtin_hash_put(lenv* env, lval* args) {
+        LASSERT_NUM("hash-put", args, 3);
+        LASSERT_TYPE("hash-put", args, 0, LVAL_HASH);
+
+        lval* map = lval_pop(args, 0);
+        lval* key = lval_pop(args, 0);
+        lhash_put(lhash_own(map), key, lval_take(args, 0));
+
+        return map;
+    }
+
+    lval* builtin_hash_del(lenv* env, lval* args) {
+        LASSERT_NUM("hash-del", args, 2);
+        LASSERT_TYPE("hash-del", args, 0, LVAL_HASH);
+
+        lval* map = lval_pop(args, 0);
+        lhash_remove(lhash_own(map), args->cell[0]);
+        lval_del(args);
+
+        return map;
+    }
+
+    lval* builtin_hash_len(lenv* env, lval* args) {
+        LASSERT_NUM("hash-len", args, 1);
+        LASSERT_TYPE("hash-len", args, 0, LVAL_HASH);
+
+        lval* len = lval_num(args->cell[0]->hash->count);
+        lval_del(args);
+
+        return len;
+    }
+
+    //Collect the keys, or {key value} pairs, of a map into a Q-Expression
+    lval* builtin_hash_list(lenv* env, lval* args, char* func) {
+        LASSERT_NUM(func, args, 1);
+        LASSERT_TYPE(func, args, 0, LVAL_HASH);
+
+        lhash* table = args->cell[0]->hash;
+        lval* list = lval_qexpr();
+
+        //Move entries out of a table nothing else shares rather than copying them
+        int shared = __atomic_load_n(&table->refs, __ATOMIC_ACQUIRE) > 1;
+        int keysOnly = strcmp(func, "hash-keys") == 0;
+
+        for(int i = 0; i < table->cap; i++) {
+            if(!table->keys[i])
+                continue;
+
+            if(shared) {
+                lval* key = lval_cpy(table->keys[i]);
+
+                if(keysOnly) {
+                    lval_add(list, key);
+                } else {
+                    lval* pair = lval_add(lval_qexpr(), key);
+                    lval_add(list, lval_add(pair, lval_cpy(table->vals[i])));
+                }
+
+                continue;
+            }
+
+            lval* key = table->keys[i];
+            table->keys[i] = NULL;
+
+            if(keysOnly) {
+                lval_del(table->vals[i]);
+                lval_add(list, key);
+            } else {
+                lval* pair = lval_add(lval_qexpr(), key);
+                lval_add(list, lval_add(pair, table->vals[i]));
+            }
+        }
+
+        if(!shared)
+            table->count = 0;
+
+        lval_del(args);
+
+        return list;
+    }
+
+    lval* builtin_hash_keys(lenv* env, lval* args) {
+        return builtin_hash_list(env, args, "hash-keys");
+    }
+
+    lval* builtin_hash_items(lenv* env, lval* args) {
+        return builtin_hash_list(env, args, "hash-items");
+    }
+
+/* Dict Builtins */
+    //Create a dict from a Q-Expression of {key value} pairs
+    lval* builtin_dict(lenv* env, lval* args) {
+        LASSERT_NUM("dict", args, 1);
+        LASSERT_TYPE("dict", args, 0, LVAL_QEXPR);
+
+        lval* pairs = args->cell[0];
+        lval* dict = lval_dict(NULL, 0);
+
+        for(int i = 0; i < pairs->count; i++) {
+            if(pairs->cell[i]->type != LVAL_QEXPR || pairs->cell[i]->count != 2) {
+                lval_del(dict);
+                lval_del(args);
+
+                return lval_err("Function 'dict' expects {key value} pairs. Got invalid pair at index %i.", i);
+            }
+
+            lval* key = lval_pop(pairs->cell[i], 0);
+            lval* val = lval_pop(pairs->cell[i], 0);
+            int added = 0;
+
+            lhamt* root = lhamt_assoc(dict->dict, 0, lval_hash(key), key, val, &added);
+            lhamt_release(dict->dict);
+
+            dict->dict = root;
+            dict->count += added;
+        }
+
+        lval_del(args);
+
+        return dict;
+    }
+
+    lval* builtin_dict_get(lenv* env, lval* args) {
+        LASSERT(args, args->count == 2 || args->count == 3,
+            "Function 'dict-get' passed incorrect number of arguments. Got %i, Expected 2 or 3.", args->count);
+        LASSERT_TYPE("dict-get", args, 0, LVAL_DICT);
+
+        lval* val = lhamt_get(args->cell[0]->dict, lval_hash(args->cell[1]), args->cell[1]);
+
+        //Fall back to the default value if one was given
+        if(!val) {
+            LASSERT(args, args->count == 3, "Function 'dict-get' could not find key.");
+
+            return lval_take(args, 2);
+        }
+
+        val = lval_cpy(val);
+        lval_del(args);
+
+        return val;
+    }
+
+    lval* builtin_dict_has(lenv* env, lval* args) {
+        LASSERT_NUM("dict-has", args, 2);
+        LASSERT_TYPE("dict-has", args, 0, LVAL_DICT);
+
+        int found = lhamt_get(args->cell[0]->dict, lval_hash(args->cell[1]), args->cell[1]) != NULL;
+        lval_del(args);
+
+        return lval_num(found);
+    }
+
+    //Returns a new dict with the key set, sharing structure with the old one
+    lval* builtin_assoc(lenv* env, lval* args) {
+        LASSERT_NUM("assoc", args, 3);
+        LASSERT_TYPE("assoc", args, 0, LVAL_DICT);
+
+        lval* dict = lval_pop(args, 0);
+        lval* key = lval_pop(args, 0);
+        lval* val = lval_take(args, 0);
+        int added = 0;
+
+        lhamt* root = lhamt_assoc(dict->dict, 0, lval_hash(key), key, val, &added);
+        lhamt_release(dict->dict);
+
+        dict->dict = root;
+        dict->count += added;
+
+        return dict;
+    }
+
+    lval* builtin_dissoc(lenv* env, lval* args) {
+        LASSERT_NUM("dissoc", args, 2);
+        LASSERT_TYPE("dissoc", args, 0, LVAL_DICT);
+
+        lval* dict = lval_pop(args, 0);
+        int removed = 0;
+
+        lhamt* root = lhamt_dissoc(dict->dict, 0, lval_hash(args->cell[0]), args->cell[0], &removed);
+        lhamt_release(dict->dict);
+
+        dict->dict = root;
+        dict->count -= removed;
+        lval_del(args);
+
+        return dict;
+    }
+
+    lval* builtin_dict_len(lenv* env, lval* args) {
+        LASSERT_NUM("dict-len", args, 1);
+        LASSERT_TYPE("dict-len", args, 0, LVAL_DICT);
+
+        lval* len = lval_num(args->cell[0]->count);
+        lval_del(args);
+
+        return len;
+    }
+
+    lval* builtin_dict_keys(lenv* env, lval* args) {
+        LASSERT_NUM("dict-keys", args, 1);
+        LASSERT_TYPE("dict-keys", args, 0, LVAL_DICT);
+
+        lval* list = lval_qexpr();
+        lhamt_collect(args->cell[0]->dict, list, 0);
+        lval_del(args);
+
+        return list;
+    }
+
+    lval* builtin_dict_items(lenv* env, lval* args) {
+        LASSERT_NUM("dict-items", args, 1);
+        LASSERT_TYPE("dict-items", args, 0, LVAL_DICT);
+
+        lval* list = lval_qexpr();
+        lhamt_collect(args->cell[0]->dict, list, 1);
+        lval_del(args);
+
+        return list;
+    }
+
+/* String Builtins */
+    //Concatenate strings. The first string is appended to in place when
+    //possible, so building a string up in a loop is linear overall.
+    lval* builtin_str_join(lenv* env, lval* args) {
+        LASSERT(args, args->count != 0, "Function 'str-join' passed no arguments.");
+
+        for(int i = 0; i < args->count; i++) {
+            LASSERT_TYPE("str-join", args, i, LVAL_STR);
+        }
+
+        lval* result = lval_pop(args, 0);
+
+        for(int i = 0; i < args->count; i++) {
+            lval_str_append(result, args->cell[i]->str, args->cell[i]->len);
+        }
+
+        lval_del(args);
+
+        return result;
+    }
+
+    lval* builtin_str_len(lenv* env, lval* args) {
+        LASSERT_NUM("str-len", args, 1);
+        LASSERT_TYPE("str-len", args, 0, LVAL_STR);
+
+        lval* len = lval_num(args->cell[0]->len);
+        lval_del(args);
+
+        return len;
+    }
+
+    //Bytes from start up to (not including) end, sharing the original's storage
+    lval* builtin_substr(lenv* env, lval* args) {
+        LASSERT_NUM("substr", args, 3);
+        LASSERT_TYPE("substr", args, 0, LVAL_NUM);
+        LASSERT_TYPE("substr", args, 1, LVAL_NUM);
+        LASSERT_TYPE("substr", args, 2, LVAL_STR);
+
+        long start = args->cell[0]->num;
+        long end = args->cell[1]->num;
+        lval* str = args->cell[2];
+
+        LASSERT(args, start >= 0 && start <= end && end <= str->len,
+            "Function 'substr' passed invalid range %li to %li for string of length %li.", start, end, str->len);
+
+        lval* sub = lval_slice(str->buf, str->str + start, end - start);
+        lval_del(args);
+
+        return sub;
+    }
+
+    //Index of the first occurrence of needle in haystack, or -1
+    long lval_str_find(lval* haystack, lval* needle) {
+        if(needle->len == 0)
+            return 0;
+
+        char* str = haystack->str;
+        char* end = haystack->str + haystack->len - needle->len;
+
+        while(str <= end) {
+            str = memchr(str, needle->str[0], end - str + 1);
+
+            if(!str)
+                break;
+
+            if(memcmp(str, needle->str, needle->len) == 0)
+                return str - haystack->str;
+
+            str++;
+        }
+
+        return -1;
+    }
+
+    lval* builtin_str_find(lenv* env, lval* args) {
+        LASSERT_NUM("str-find", args, 2);
+        LASSERT_TYPE("str-find", args, 0, LVAL_STR);
+        LASSERT_TYPE("str-find", args, 1, LVAL_STR);
+
+        lval* index = lval_num(lval_str_find(args->cell[1], args->cell[0]));
+        lval_del(args);
+
+        return index;
+    }
+
+    //Split a string on a separator into a Q-Expression of slices
+    lval* builtin_str_split(lenv* env, lval* args) {
+        LASSERT_NUM("str-split", args, 2);
+        LASSERT_TYPE("str-split", args, 0, LVAL_STR);
+        LASSERT_TYPE("str-split", args, 1, LVAL_STR);
+        LASSERT(args, args->cell[0]->len != 0, "Function 'str-split' passed an empty separator.");
+
+        lval* sep = args->cell[0];
+        lval* str = args->cell[1];
+        lval* parts = lval_qexpr();
+
+        //Walk a slice of the remaining string forward past each separator
+        lval rest = *str;
+        long index;
+
+        while((index = lval_str_find(&rest, sep)) >= 0) {
+            lval_add(parts, lval_slice(str->buf, rest.str, index));
+
+            rest.str += index + sep->len;
+            rest.len -= index + sep->len;
+        }
+
+        lval_add(parts, lval_slice(str->buf, rest.str, rest.len));
+        lval_del(args);
+
+        return parts;
+    }
+
+    lval* builtin_str_num(lenv* env, lval* args) {
+        LASSERT_NUM("str->num", args, 1);
+        LASSERT_TYPE("str->num", args, 0, LVAL_STR);
+
+        char* str = lval_cstr(args->cell[0]);
+        char* end;
+
+        errno = 0;
+        long x = strtol(str, &end, 10);
+
+        int valid = (end != str && *end == '\0' && errno != ERANGE);
+        free(str);
+
+        LASSERT(args, valid, "Function 'str->num' passed string that is not a valid number.");
+
+        lval_del(args);
+
+        return lval_num(x);
+    }
+
+    //The printed form of a value, as print would write it
+    lval* builtin_to_string(lenv* env, lval* args) {
+        LASSERT_NUM("to-string", args, 1);
+
+        lsink sink = { malloc(64), 0, 64, NULL };
+        lval_sink(&sink, args->cell[0]);
+        lval_del(args);
+
+        lval* str = lval_str_len(sink.data, sink.len);
+        free(sink.data);
+
+        return str;
+    }
+
+/* Lazy Sequence Builtins */
+    //A lazy sequence is a chain of nodes, each holding an item and the rest
+    //of the sequence. A node starts as a thunk saying how to make them and
+    //is forced the first time it is read. Forcing keeps the item and rest
+    //and drops the thunk, so each item is computed once however many copies
+    //share the node. Nodes nobody holds are freed as a pipeline moves on,
+    //so walking one takes constant memory.
+    enum { LSEQ_RANGE, LSEQ_MAP, LSEQ_FILTER, LSEQ_TAKE };
+
+    struct lseq {
+        int refs;
+        pthread_mutex_t lock;
+        int forced;
+
+        /* Thunk - a range counts from by step up to to if bounded, a take
+           has from items left */
+        int kind;
+        long from;
+        long to;
+        long step;
+        int bounded;
+        lval* func;
+        lseq* source;
+
+        /* Forced - first is NULL at the end */
+        lval* first;
+        lseq* rest;
+    };
+
+    lseq* lseq_new(int kind) {
+        lseq* seq = calloc(1, sizeof(lseq));
+
+        seq->refs = 1;
+        seq->kind = kind;
+        pthread_mutex_init(&seq->lock, NULL);
+
+        return seq;
+    }
+
+    //Releases along rest in a loop, as forced chains can be long
+    void lseq_release(lseq* seq) {
+        while(seq && LREF_DEC(seq->refs) == 0) {
+            lseq* rest = seq->rest;
+
+            if(seq->first) lval_del(seq->first);
+            if(seq->func) lval_del(seq->func);
+            lseq_release(seq->source);
+
+            pthread_mutex_destroy(&seq->lock);
+            free(seq);
+
+            seq = rest;
+        }
+    }
+
+    lseq* lseq_retain(lseq* seq) {
+        LREF_INC(seq->refs);
+        return seq;
+    }
+
+    lseq* lseq_range(long from, long to, long step, int bounded) {
+        lseq* seq = lseq_new(LSEQ_RANGE);
+
+        seq->from = from;
+        seq->to = to;
+        seq->step = step;
+        seq->bounded = bounded;
+
+        return seq;
+    }
+
+    //A thunk applying func to source, for map and filter
+    lseq* lseq_apply(int kind, lval* func, lseq* source) {
+        lseq* seq = lseq_new(kind);
+
+        seq->func = func;
+        seq->source = source;
+
+        return seq;
+    }
+
+    lseq* lseq_take(long count, lseq* source) {
+        lseq* seq = lseq_new(LSEQ_TAKE);
+
+        seq->from = count;
+        seq->source = source;
+
+        return seq;
+    }
+
+    //A forced sequence of the items in a Q-Expression, built from the end
+    lseq* lseq_list(lval* list) {
+        lseq* seq = lseq_new(LSEQ_RANGE);
+        seq->forced = 1;
+
+        for(int i = list->count - 1; i >= 0; i--) {
+            lseq* node = lseq_new(LSEQ_RANGE);
+
+            node->forced = 1;
+            node->first = lval_cpy(list->cell[i]);
+            node->rest = seq;
+            seq = node;
+        }
+
+        return seq;
+    }
+
+    //Call a copy of func on args, as lval_eval_sexpr does
+    lval* lseq_call(lenv* env, lval* func, lval* args) {
+        lval* fun = lval_cpy(func);
+        lval* result = lval_call(env, fun, args);
+        lval_del(fun);
+
+        return result;
+    }
+
+    //Force a node, returning an error raised on the way or NULL. A node
+    //that fails stays a thunk.
+    lval* lseq_force(lenv* env, lseq* seq) {
+        pthread_mutex_lock(&seq->lock);
+
+        if(seq->forced) {
+            pthread_mutex_unlock(&seq->lock);
+            return NULL;
+        }
+
+        lval* err = NULL;
+
+        switch(seq->kind) {
+            case LSEQ_RANGE:
+                if(seq->bounded && (seq->step > 0 ? seq->from >= seq->to : seq->from <= seq->to))
+                    break;
+
+                seq->first = lval_num(seq->from);
+                seq->rest = lseq_range(seq->from + seq->step, seq->to, seq->step, seq->bounded);
+                break;
+
+            case LSEQ_MAP: {
+                if((err = lseq_force(env, seq->source)) || !seq->source->first)
+                    break;
+
+                lval* x = lseq_call(env, seq->func, lval_add(lval_sexpr(), lval_cpy(seq->source->first)));
+
+                if(x->type == LVAL_ERR) {
+                    err = x;
+                    break;
+                }
+
+                seq->first = x;
+                seq->rest = lseq_apply(LSEQ_MAP, lval_cpy(seq->func), lseq_retain(seq->source->rest));
+                break;
+            }
+
+            case LSEQ_FILTER: {
+                //Skip to the next item that passes, holding only the node at hand
+                lseq* node = lseq_retain(seq->source);
+
+                while(!(err = lseq_force(env, node)) && node->first) {
+                    lval* x = lseq_call(env, seq->func, lval_add(lval_sexpr(), lval_cpy(node->first)));
+
+                    if(x->type != LVAL_NUM) {
+                        err = x->type == LVAL_ERR ? x : lval_err("Function 'lazy-filter' predicate returned %s, expected %s.",
+                            ltype_name(x->type), ltype_name(LVAL_NUM));
+
+                        if(err != x) lval_del(x);
+                        break;
+                    }
+
+                    int keep = x->num != 0;
+                    lval_del(x);
+
+                    if(keep) {
+                        seq->first = lval_cpy(node->first);
+                        seq->rest = lseq_apply(LSEQ_FILTER, lval_cpy(seq->func), lseq_retain(node->rest));
+                        break;
+                    }
+
+                    lseq* rest = lseq_retain(node->rest);
+                    lseq_release(node);
+                    node = rest;
+                }
+
+                lseq_release(node);
+                break;
+            }
+
+            case LSEQ_TAKE:
+                //Past the count the source isn't touched
+                if(seq->from <= 0 || (err = lseq_force(env, seq->source)) || !seq->source->first)
+                    break;
+
+                seq->first = lval_cpy(seq->source->first);
+                seq->rest = lseq_take(seq->from - 1, lseq_retain(seq->source->rest));
+                break;
+        }
+
+        if(!err) {
+            seq->forced = 1;
+
+            if(seq->func) {
+                lval_del(seq->func);
+                seq->func = NULL;
+            }
+
+            lseq_release(seq->source);
+            seq->source = NULL;
+        }
+
+        pthread_mutex_unlock(&seq->lock);
+
+        return err;
+    }
+
+    //The sequence a builtin was passed, as a new reference
+    lseq* lseq_arg(lval* val) {
+        return val->type == LVAL_SEQ ? lseq_retain(val->seq) : lseq_list(val);
+    }
+
+    #define LASSERT_SEQ(func, args, index) \
+        LASSERT(args, args->cell[index]->type == LVAL_SEQ || args->cell[index]->type == LVAL_QEXPR, \
+            "Function '%s' passed incorrect type for argument %i. Got %s, Expected %s or %s.", \
+            func, index, ltype_name(args->cell[index]->type), ltype_name(LVAL_SEQ), ltype_name(LVAL_QEXPR));
+
+    //(range from), (range from to) or (range from to step), counting up to
+    //but not including to, or forever without it
+    lval* builtin_range(lenv* env, lval* args) {
+        LASSERT(args, args->count >= 1 && args->count <= 3,
+            "Function 'range' passed incorrect number of arguments. Got %i, Expected 1 to 3.", args->count);
+
+        for(int i = 0; i < args->count; i++) {
+            LASSERT_TYPE("range", args, i, LVAL_NUM);
+        }
+
+        long step = args->count == 3 ? args->cell[2]->num : 1;
+
+        LASSERT(args, step != 0, "Function 'range' passed a step of 0.");
+
+        lseq* seq = lseq_range(args->cell[0]->num, args->count > 1 ? args->cell[1]->num : 0, step, args->count > 1);
+        lval_del(args);
+
+        return lval_seq(seq);
+    }
+
+    lval* builtin_lazy_map(lenv* env, lval* args) {
+        LASSERT_NUM("lazy-map", args, 2);
+        LASSERT_TYPE("lazy-map", args, 0, LVAL_FUN);
+        LASSERT_SEQ("lazy-map", args, 1);
+
+        lseq* seq = lseq_apply(LSEQ_MAP, lval_cpy(args->cell[0]), lseq_arg(args->cell[1]));
+        lval_del(args);
+
+        return lval_seq(seq);
+    }
+
+    lval* builtin_lazy_filter(lenv* env, lval* args) {
+        LASSERT_NUM("lazy-filter", args, 2);
+        LASSERT_TYPE("lazy-filter", args, 0, LVAL_FUN);
+        LASSERT_SEQ("lazy-filter", args, 1);
+
+        lseq* seq = lseq_apply(LSEQ_FILTER, lval_cpy(args->cell[0]), lseq_arg(args->cell[1]));
+        lval_del(args);
+
+        return lval_seq(seq);
+    }
+
+    lval* builtin_lazy_take(lenv* env, lval* args) {
+        LASSERT_NUM("lazy-take", args, 2);
+        LASSERT_TYPE("lazy-take", args, 0, LVAL_NUM);
+        LASSERT_SEQ("lazy-take", args, 1);
+
+        lseq* seq = lseq_take(args->cell[0]->num, lseq_arg(args->cell[1]));
+        lval_del(args);
+
+        return lval_seq(seq);
+    }
+
+    //Every item of a sequence as a Q-Expression
+    lval* builtin_realize(lenv* env, lval* args) {
+        LASSERT_NUM("realize", args, 1);
+        LASSERT_SEQ("realize", args, 0);
+
+        lseq* node = lseq_arg(args->cell[0]);
+        lval_del(args);
+
+        lval* list = lval_qexpr();
+        lval* err;
+
+        while(!(err = lseq_force(env, node)) && node->first) {
+            lval_add(list, lval_cpy(node->first));
+
+            lseq* rest = lseq_retain(node->rest);
+            lseq_release(node);
+            node = rest;
+        }
+
+        lseq_release(node);
+
+        if(err) {
+            lval_del(list);
+            return err;
+        }
+
+        return list;
+    }
+
+    //(lazy-fold f z s) is foldl over a sequence, keeping none of it
+    lval* builtin_lazy_fold(lenv* env, lval* args) {
+        LASSERT_NUM("lazy-fold", args, 3);
+        LASSERT_TYPE("lazy-fold", args, 0, LVAL_FUN);
+        LASSERT_SEQ("lazy-fold", args, 2);
+
+        lval* func = lval_pop(args, 0);
+        lval* acc = lval_pop(args, 0);
+        lseq* node = lseq_arg(args->cell[0]);
+        lval_del(args);
+
+        lval* err;
+
+        while(!(err = lseq_force(env, node)) && node->first) {
+            acc = lseq_call(env, func, lval_add(lval_add(lval_sexpr(), acc), lval_cpy(node->first)));
+
+            if(acc->type == LVAL_ERR)
+                break;
+
+            lseq* rest = lseq_retain(node->rest);
+            lseq_release(node);
+            node = rest;
+        }
+
+        lseq_release(node);
+        lval_del(func);
+
+        if(err) {
+            lval_del(acc);
+            return err;
+        }
+
+        return acc;
+    }
+
+/* File Builtins */
+    //An open file, shared by every copy of its handle and closed with the
+    //last one if close wasn't called. Reads and writes go through a large
+    //stdio buffer, and the lock keeps a close on one thread from pulling
+    //the stream out from under a read on another.
+    #define LFILE_BUFFER (1 << 20)
+
+    struct lfile {
+        int refs;
+        pthread_mutex_t lock;
+
+        FILE* fp;
+        char* buffer;
+
+        //Reused by read-line
+        char* line;
+        size_t lineCap;
+    };
+
+    void lfile_close(lfile* file) {
+        if(!file->fp)
+            return;
+
+        fclose(file->fp);
+        file->fp = NULL;
+
+        free(file->buffer);
+        file->buffer = NULL;
+    }
+
+    void lfile_release(lfile* file) {
+        if(LREF_DEC(file->refs) > 0)
+            return;
+
+        lfile_close(file);
+        free(file->line);
+        pthread_mutex_destroy(&file->lock);
+        free(file);
+    }
+
+    //Checks the handle is open, taking its lock if so
+    #define LFILE_LOCK(func, args, file) \
+        pthread_mutex_lock(&file->lock); \
+        if(!file->fp) { \
+            pthread_mutex_unlock(&file->lock); \
+            lval* err = lval_err("Function '%s' passed a closed file.", func); \
+            lval_del(args); \
+            return err; \
+        }
+
+    //Strip one line ending, \n or \r\n
+    long lfile_chomp(char* line, long len) {
+        if(len && line[len - 1] == '\n') len--;
+        if(len && line[len - 1] == '\r') len--;
+
+        return len;
+    }
+
+    //(open path mode) with a mode as for fopen, "r", "w" or "a"
+    lval* builtin_open(lenv* env, lval* args) {
+        LASSERT_NUM("open", args, 2);
+        LASSERT_TYPE("open", args, 0, LVAL_STR);
+        LASSERT_TYPE("open", args, 1, LVAL_STR);
+
+        char* path = lval_cstr(args->cell[0]);
+        char* mode = lval_cstr(args->cell[1]);
+        lval_del(args);
+
+        int valid = strcmp(mode, "r") == 0 || strcmp(mode, "w") == 0 || strcmp(mode, "a") == 0;
+        FILE* fp = valid ? fopen(path, mode) : NULL;
+        lval* result;
+
+        if(!valid) {
+            result = lval_err("Function 'open' passed mode \"%s\", expected \"r\", \"w\" or \"a\".", mode);
+        } else if(!fp) {
+            result = lval_err("Could not open file %s: %s", path, strerror(errno));
+        } else {
+            lfile* file = calloc(1, sizeof(lfile));
+
+            file->refs = 1;
+            pthread_mutex_init(&file->lock, NULL);
+            file->fp = fp;
+            file->buffer = malloc(LFILE_BUFFER);
+            setvbuf(fp, file->buffer, _IOFBF, LFILE_BUFFER);
+
+            result = lval_file(file);
+        }
+
+        free(path);
+        free(mode);
+
+        return result;
+    }
+
+    //The next line without its line ending, or {} at the end of the file
+    lval* builtin_read_line(lenv* env, lval* args) {
+        LASSERT_NUM("read-line", args, 1);
+        LASSERT_TYPE("read-line", args, 0, LVAL_FILE);
+
+        lfile* file = args->cell[0]->stream;
+        LFILE_LOCK("read-line", args, file);
+
+        ssize_t len = getline(&file->line, &file->lineCap, file->fp);
+        lval* result = len < 0 ? lval_qexpr() : lval_str_len(file->line, lfile_chomp(file->line, len));
+
+        pthread_mutex_unlock(&file->lock);
+        lval_del(args);
+
+        return result;
+    }
+
+    //Up to n bytes as a string, or {} at the end of the file
+    lval* builtin_read_chunk(lenv* env, lval* args) {
+        LASSERT_NUM("read-chunk", args, 2);
+        LASSERT_TYPE("read-chunk", args, 0, LVAL_FILE);
+        LASSERT_TYPE("read-chunk", args, 1, LVAL_NUM);
+        LASSERT(args, args->cell[1]->num > 0, "Function 'read-chunk' passed a size less than 1.");
+
+        lfile* file = args->cell[0]->stream;
+        LFILE_LOCK("read-chunk", args, file);
+
+        //Read straight into the string's buffer
+        lbuf* buf = lbuf_new(args->cell[1]->num);
+        buf->used = fread(buf->data, 1, buf->cap, file->fp);
+
+        pthread_mutex_unlock(&file->lock);
+        lval_del(args);
+
+        lval* result = buf->used ? lval_slice(buf, buf->data, buf->used) : lval_qexpr();
+        lbuf_release(buf);
+
+        return result;
+    }
+
+    //(write file x ...) writes strings as they are and anything else as
+    //print would
+    lval* builtin_write(lenv* env, lval* args) {
+        LASSERT(args, args->count >= 1, "Function 'write' passed no arguments.");
+        LASSERT_TYPE("write", args, 0, LVAL_FILE);
+
+        lfile* file = args->cell[0]->stream;
+        LFILE_LOCK("write", args, file);
+
+        char data[LSINK_SIZE];
+        lsink sink = { data, 0, sizeof(data), file->fp };
+
+        for(int i = 1; i < args->count; i++) {
+            lval* x = args->cell[i];
+
+            if(x->type == LVAL_STR)
+                lsink_write(&sink, x->str, x->len);
+            else
+                lval_sink(&sink, x);
+        }
+
+        lsink_flush(&sink);
+        int failed = ferror(file->fp);
+
+        pthread_mutex_unlock(&file->lock);
+        lval_del(args);
+
+        return failed ? lval_err("Function 'write' could not write: %s", strerror(errno)) : lval_sexpr();
+    }
+
+    lval* builtin_close(lenv* env, lval* args) {
+        LASSERT_NUM("close", args, 1);
+        LASSERT_TYPE("close", args, 0, LVAL_FILE);
+
+        lfile* file = args->cell[0]->stream;
+
+        pthread_mutex_lock(&file->lock);
+        lfile_close(file);
+        pthread_mutex_unlock(&file->lock);
+
+        lval_del(args);
+
+        return lval_sexpr();
+    }
+
+    //Fold one line into the accumulator, taking acc
+    lval* lfile_fold_line(lenv* env, lval* func, lval* acc, char* line, long len) {
+        lval* fun = lval_cpy(func);
+        lval* args = lval_add(lval_add(lval_sexpr(), acc), lval_str_len(line, lfile_chomp(line, len)));
+        lval* result = lval_call(env, fun, args);
+        lval_del(fun);
+
+        return result;
+    }
+
+    //(fold-lines f z file) is foldl of f over the lines of a file, given by
+    //path or open handle, without holding more than a line at a time. A
+    //path is mapped and walked in order; a handle, or a path that can't be
+    //mapped like a pipe, is read a line at a time.
+    lval* builtin_fold_lines(lenv* env, lval* args) {
+        LASSERT_NUM("fold-lines", args, 3);
+        LASSERT_TYPE("fold-lines", args, 0, LVAL_FUN);
+        LASSERT(args, args->cell[2]->type == LVAL_STR || args->cell[2]->type == LVAL_FILE,
+            "Function 'fold-lines' passed incorrect type for argument 2. Got %s, Expected %s or %s.",
+            ltype_name(args->cell[2]->type), ltype_name(LVAL_STR), ltype_name(LVAL_FILE));
+
+        lval* func = lval_pop(args, 0);
+        lval* acc = lval_pop(args, 0);
+        lval* source = lval_pop(args, 0);
+        lval_del(args);
+
+        lfile* file = NULL;
+        FILE* fp = NULL;
+
+        if(source->type == LVAL_STR) {
+            char* path = lval_cstr(source);
+            int fd = open(path, O_RDONLY);
+            struct stat st;
+
+            if(fd < 0) {
+                lval_del(acc);
+                acc = lval_err("Could not open file %s: %s", path, strerror(errno));
+            } else if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+                char* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+                if(map != MAP_FAILED) {
+                    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+                    char* end = map + st.st_size;
+
+                    for(char* line = map; line < end && acc->type != LVAL_ERR; ) {
+                        char* newline = memchr(line, '\n', end - line);
+                        char* next = newline ? newline + 1 : end;
+
+                        acc = lfile_fold_line(env, func, acc, line, next - line);
+                        line = next;
+                    }
+
+                    munmap(map, st.st_size);
+                    close(fd);
+                    fd = -1;
+                }
+            }
+
+            //Not mapped, so read it through stdio
+            if(fd >= 0) {
+                fp = fdopen(fd, "r");
+                setvbuf(fp, NULL, _IOFBF, LFILE_BUFFER);
+            }
+
+            free(path);
+        } else {
+            file = source->stream;
+            pthread_mutex_lock(&file->lock);
+            fp = file->fp;
+            pthread_mutex_unlock(&file->lock);
+
+            if(!fp) {
+                lval_del(acc);
+                acc = lval_err("Function 'fold-lines' passed a closed file.");
+            }
+        }
+
+        if(fp) {
+            char* line = NULL;
+            size_t cap = 0;
+            ssize_t len;
+
+            //A handle is only locked while each line is read, so the function
+            //can use it too. Folding stops if the function closes it.
+            while(acc->type != LVAL_ERR) {
+                if(file) {
+                    pthread_mutex_lock(&file->lock);
+                    fp = file->fp;
+                }
+
+                len = fp ? getline(&line, &cap, fp) : -1;
+
+                if(file)
+                    pthread_mutex_unlock(&file->lock);
+
+                if(len < 0)
+                    break;
+
+                acc = lfile_fold_line(env, func, acc, line, len);
+            }
+
+            free(line);
+
+            if(!file)
+                fclose(fp);
+        }
+
+        lval_del(source);
+        lval_del(func);
+
+        return acc;
+    }
+
+/* Memo Builtins */
+    //Wrap a function with a result cache, optionally bounded to a capacity
+    //with least recently used eviction
+    lval* builtin_memo(lenv* env, lval* args) {
+        LASSERT(args, args->count == 1 || args->count == 2,
+            "Function 'memo' passed incorrect number of arguments. Got %i, Expected 1 or 2.", args->count);
+        LASSERT_TYPE("memo", args, 0, LVAL_FUN);
+
+        long capacity = 0;
+
+        if(args->count == 2) {
+            LASSERT_TYPE("memo", args, 1, LVAL_NUM);
+            LASSERT(args, args->cell[1]->num > 0, "Function 'memo' passed capacity %li, Expected at least 1.", args->cell[1]->num);
+
+            capacity = args->cell[1]->num;
+        }
+
+        lval* func = lval_pop(args, 0);
+        lval_del(args);
+
+        //Rewrapping replaces the old cache
+        if(func->memo)
+            lmemo_release(func->memo);
+
+        func->memo = lmemo_new(capacity);
+
+        return func;
+    }
+
+    lval* builtin_memo_stats(lenv* env, lval* args) {
+        LASSERT_NUM("memo-stats", args, 1);
+        LASSERT_TYPE("memo-stats", args, 0, LVAL_FUN);
+        LASSERT(args, args->cell[0]->memo, "Function 'memo-stats' passed a function that is not memoized.");
+
+        lmemo* memo = args->cell[0]->memo;
+
+        char* names[] = { "hits", "misses", "size", "capacity", "evictions" };
+
+        pthread_mutex_lock(&memo->lock);
+        long counts[] = { memo->hits, memo->misses, memo->count, memo->capacity, memo->evictions };
+        pthread_mutex_unlock(&memo->lock);
+
+        lval* list = lval_qexpr();
+
+        for(int i = 0; i < 5; i++) {
+            lval* pair = lval_add(lval_qexpr(), lval_sym(names[i]));
+            lval_add(list, lval_add(pair, lval_num(counts[i])));
+        }
+
+        lval_del(args);
+
+        return list;
+    }
+
+/* Thread Builtins */
+    //Spawned threads get a stack well past the usual default since
+    //evaluation recurses on the C stack
+    #define LTHREAD_STACK (64 * 1024 * 1024)
+
+    void lthread_release(lthread* thread) {
+        if(LREF_DEC(thread->refs) > 0)
+            return;
+
+        if(thread->result)
+            lval_del(thread->result);
+
+        pthread_mutex_destroy(&thread->lock);
+        pthread_cond_destroy(&thread->finished);
+        free(thread);
+    }
+
+    void* lthread_main(void* arg) {
+        lthread* thread = arg;
+
+        lval* result = lval_call(thread->env, thread->func, thread->args);
+        lval_del(thread->func);
+
+        pthread_mutex_lock(&thread->lock);
+        thread->result = result;
+        thread->done = 1;
+        pthread_cond_broadcast(&thread->finished);
+        pthread_mutex_unlock(&thread->lock);
+
+        lthread_release(thread);
+
+        //Fold this thread's counters and heap back into the process
+        lstats_flush();
+        lheap_drain();
+
+        //The global env is no longer touched by this thread
+        __atomic_sub_fetch(&lthread_running, 1, __ATOMIC_RELEASE);
+
+        return NULL;
+    }
+
+    //Call a function with the remaining arguments on a new thread, in the
+    //global env. The values are the thread's own; strings and dicts share
+    //their immutable storage with the caller.
+    lval* builtin_spawn(lenv* env, lval* args) {
+        LASSERT(args, args->count >= 1, "Function 'spawn' passed no arguments.");
+        LASSERT_TYPE("spawn", args, 0, LVAL_FUN);
+
+        while(env->parent) {
+            env = env->parent;
+        }
+
+        lthread* thread = calloc(1, sizeof(lthread));
+        thread->refs = 2;
+        pthread_mutex_init(&thread->lock, NULL);
+        pthread_cond_init(&thread->finished, NULL);
+        thread->env = env;
+        thread->func = lval_pop(args, 0);
+        thread->args = args;
+
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setstacksize(&attr, LTHREAD_STACK);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+        __atomic_add_fetch(&lthread_running, 1, __ATOMIC_ACQ_REL);
+
+        pthread_t id;
+        int failed = pthread_create(&id, &attr, lthread_main, thread);
+        pthread_attr_destroy(&attr);
+
+        if(failed) {
+            __atomic_sub_fetch(&lthread_running, 1, __ATOMIC_RELEASE);
+
+            lval_del(thread->func);
+            lval_del(thread->args);
+            thread->refs = 1;
+            lthread_release(thread);
+
+            return lval_err("Function 'spawn' could not start a thread.");
+        }
+
+        return lval_thread(thread);
+    }
+
+    //Wait for a thread and return a copy of its result, errors included
+    lval* builtin_join_thread(lenv* env, lval* args) {
+        lthread* thread = args->cell[0]->thread;
+
+        pthread_mutex_lock(&thread->lock);
+
+        while(!thread->done) {
+            pthread_cond_wait(&thread->finished, &thread->lock);
+        }
+
+        pthread_mutex_unlock(&thread->lock);
+
+        lval* result = lval_cpy(thread->result);
+        lval_del(args);
+
+        return result;
+    }
+
+/* Thread Pool */
+    //Workers for the parallel builtins, started on first use. Each worker
+    //owns a deque of tasks, pushing and popping its own at the bottom, while
+    //workers that run dry steal the oldest task from the top of another's.
+    //Threads outside the pool submit to one more shared deque. A thread
+    //waiting on its tasks runs queued ones meanwhile instead of blocking,
+    //so the pool is sized one short of the thread count, the caller
+    //making up the last. LISPY_THREADS overrides the count of cores.
+    typedef struct ltask {
+        void (*run)(struct ltask* task);
+        int done;
+
+        //Cancel flag the task runs under, whichever thread runs it
+        int* cancel;
+
+        //Called once done is set, if the task should then let go of itself
+        void (*release)(struct ltask* task);
+    } ltask;
+
+    //Ring buffer of tasks between head (top) and tail (bottom)
+    typedef struct {
+        pthread_mutex_t lock;
+        ltask** tasks;
+        long head;
+        long tail;
+        long cap;
+    } ldeque;
+
+    typedef struct {
+        int threads;
+        int workers;
+        ldeque* deques;
+
+        //Idle workers sleep until pending tasks are pushed
+        pthread_mutex_t lock;
+        pthread_cond_t wake;
+        int pending;
+    } lpool;
+
+    lpool pool;
+    pthread_once_t lpool_once = PTHREAD_ONCE_INIT;
+
+    //Index of this thread's deque, the shared one outside the pool
+    __thread int lpool_self = -1;
+
+    void ldeque_push(ldeque* deque, ltask* task) {
+        pthread_mutex_lock(&deque->lock);
+
+        if(deque->tail - deque->head == deque->cap) {
+            long cap = deque->cap ? deque->cap * 2 : 64;
+            ltask** tasks = malloc(sizeof(ltask*) * cap);
+
+            for(long i = deque->head; i < deque->tail; i++) {
+                tasks[i & (cap - 1)] = deque->tasks[i & (deque->cap - 1)];
+            }
+
+            free(deque->tasks);
+            deque->tasks = tasks;
+            deque->cap = cap;
+        }
+
+        deque->tasks[deque->tail++ & (deque->cap - 1)] = task;
+        pthread_mutex_unlock(&deque->lock);
+    }
+
+    //Take the newest task for the owner or the oldest for a thief
+    ltask* ldeque_take(ldeque* deque, int steal) {
+        ltask* task = NULL;
+
+        pthread_mutex_lock(&deque->lock);
+
+        if(deque->tail > deque->head) {
+            task = steal ? deque->tasks[deque->head++ & (deque->cap - 1)]
+                         : deque->tasks[--deque->tail & (deque->cap - 1)];
+        }
+
+        pthread_mutex_unlock(&deque->lock);
+
+        return task;
+    }
+
+    //Find a task to run, from this thread's deque first then any other's
+    ltask* lpool_take(void) {
+        int self = lpool_self < 0 ? pool.workers : lpool_self;
+        ltask* task = ldeque_take(&pool.deques[self], 0);
+
+        for(int i = 1; !task && i <= pool.workers; i++) {
+            task = ldeque_take(&pool.deques[(self + i) % (pool.workers + 1)], 1);
+        }
+
+        if(task)
+            __atomic_sub_fetch(&pool.pending, 1, __ATOMIC_RELAXED);
+
+        return task;
+    }
+
+    void lpool_run(ltask* task) {
+        //A task without release may be freed by its waiter once done is set
+        void (*release)(ltask* task) = task->release;
+
+        //A thread waiting on a task runs others meanwhile, so keep its flag
+        int* cancel = lfuture_cancel;
+        lfuture_cancel = task->cancel;
+
+        task->run(task);
+        __atomic_store_n(&task->done, 1, __ATOMIC_RELEASE);
+
+        lfuture_cancel = cancel;
+
+        if(release)
+            release(task);
+    }
+
+    void* lpool_worker(void* arg) {
+        lpool_self = (int)(long)arg;
+
+        //Wait until lpool_start has counted every worker
+        pthread_mutex_lock(&pool.lock);
+        pthread_mutex_unlock(&pool.lock);
+
+        while(1) {
+            ltask* task = lpool_take();
+
+            if(task) {
+                lpool_run(task);
+
+                //Workers never exit, so hand over their counters as they go
+                lstats_flush();
+                continue;
+            }
+
+            pthread_mutex_lock(&pool.lock);
+
+            while(!__atomic_load_n(&pool.pending, __ATOMIC_RELAXED)) {
+                pthread_cond_wait(&pool.wake, &pool.lock);
+            }
+
+            pthread_mutex_unlock(&pool.lock);
+        }
+
+        return NULL;
+    }
+
+    void lpool_start(void) {
+        char* env = getenv("LISPY_THREADS");
+        long threads = env ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+
+        pool.threads = threads < 1 ? 1 : threads;
+        pool.workers = 0;
+        pool.deques = calloc(pool.threads, sizeof(ldeque));
+        pthread_mutex_init(&pool.lock, NULL);
+        pthread_cond_init(&pool.wake, NULL);
+
+        for(int i = 0; i < pool.threads; i++) {
+            pthread_mutex_init(&pool.deques[i].lock, NULL);
+        }
+
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setstacksize(&attr, LTHREAD_STACK);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+        //Workers read the count to find deques, so hold them off until it's final
+        pthread_mutex_lock(&pool.lock);
+
+        for(int i = 0; i < pool.threads - 1; i++) {
+            pthread_t id;
+
+            if(pthread_create(&id, &attr, lpool_worker, (void*)(long)i) != 0)
+                break;
+
+            pool.workers++;
+        }
+
+        pthread_mutex_unlock(&pool.lock);
+        pthread_attr_destroy(&attr);
+    }
 
-        return poppedVal;
+    //Number of threads tasks are spread over, the caller included
+    int lpool_threads(void) {
+        pthread_once(&lpool_once, lpool_start);
+        return pool.workers + 1;
     }
 
-    //Same as lval_pop, but deletes remaining list
-    lval* lval_take(lval* val, int index) {
-        lval* takeVal = lval_pop(val, index);
-        lval_del(val);
+    void lpool_submit(ltask* task) {
+        task->done = 0;
+        ldeque_push(&pool.deques[lpool_self < 0 ? pool.workers : lpool_self], task);
 
-        return takeVal;
+        pthread_mutex_lock(&pool.lock);
+        __atomic_add_fetch(&pool.pending, 1, __ATOMIC_RELAXED);
+        pthread_cond_signal(&pool.wake);
+        pthread_mutex_unlock(&pool.lock);
     }
 
-    //Evaluate an lval
-    lval* lval_eval(lenv* env, lval* val) {
-        //Evaluate symbols
-        if(val->type == LVAL_SYM) {
-            lval* res = lenv_get(env, val);
-            lval_del(val);
+    //Wait for a task, running others until it is done
+    void lpool_wait(ltask* task) {
+        while(!__atomic_load_n(&task->done, __ATOMIC_ACQUIRE)) {
+            ltask* other = lpool_take();
 
-            return res;
+            if(other)
+                lpool_run(other);
+            else
+                sched_yield();
         }
+    }
 
-        //Evaluate s-expressions
-        if(val->type == LVAL_SEXPR)
-            return lval_eval_sexpr(env, val);
+/* Parallel Builtins */
+    //Lists shorter than this are mapped or reduced on the calling thread,
+    //and longer ones are cut into chunks no shorter than it
+    #define LPAR_SEQUENTIAL 32
 
-        //All other lval types remain the same
-        return val;
-    }
+    //Chunks per thread, so threads that finish early can steal the rest
+    #define LPAR_CHUNKS_PER_THREAD 4
 
-    //Perform an operation on an expression
-    lval* builtin_op(lenv* env, lval* args, char* op) {
-        //Ensure all args are numbers
-        for(int i = 0; i < args->count; i++) {
-            if(args->cell[i]->type != LVAL_NUM) {
-                lval_del(args);
+    //A run of list items mapped, or folded with func, by one task
+    typedef struct {
+        ltask task;
+        lenv* env;
+        lval* func;
+        lval* items;
+        int reduce;
+        lval* result;
 
-                return lval_err("Cannot operate on non-number!");
-            }
-        }
+        //The caller's output, which it waits on
+        FILE* out;
+    } lpar_chunk;
 
-        //Pop the first element
-        lval* x = lval_pop(args, 0);
+    //Call a copy of func on the arguments, as lval_eval_sexpr does
+    lval* lpar_call(lenv* env, lval* func, lval* args) {
+        lval* fun = lval_cpy(func);
+        lval* result = lval_call(env, fun, args);
+        lval_del(fun);
 
-        //If no arguments and sub then perform unary negation
-        if((strcmp(op, "-") == 0) && args->count == 0) {
-            x->num = -x->num;
-        }
-
-        //While there are still elements remaining
-        while(args->count > 0) {
-            //Pop the next element
-            lval* y = lval_pop(args, 0);
-
-            if(strcmp(op, "+") == 0)
-                x->num += y->num;
-            else if(strcmp(op, "-") == 0)
-                x->num -= y->num;
-            else if(strcmp(op, "*") == 0)
-                x->num *= y->num;
-            else if(strcmp(op, "/") == 0) {
-                if(y->num == 0) {
-                    lval_del(x);
-                    lval_del(y);
+        return result;
+    }
 
-                    x = lval_err("Cannot Divide by Zero!");
-                    break;
-                }
+    //Map the chunk to a Q-Expression of results or fold it from its first
+    //item, stopping at the first error. Items are handed to func in place.
+    void lpar_chunk_run(ltask* task) {
+        lpar_chunk* chunk = (lpar_chunk*)task;
+        lval* items = chunk->items;
+        lval* result;
+        int i;
 
-                x->num /= y->num;
+        FILE* out = lout;
+        lout = chunk->out;
+
+        if(chunk->reduce) {
+            result = items->cell[0];
+
+            for(i = 1; i < items->count && result->type != LVAL_ERR; i++) {
+                lval* args = lval_add(lval_add(lval_sexpr(), result), items->cell[i]);
+                result = lpar_call(chunk->env, chunk->func, args);
             }
-            else if(strcmp(op, "%") == 0) {
-                if(y->num == 0) {
-                    lval_del(x);
-                    lval_del(y);
+        } else {
+            result = lval_qexpr();
+            result->cell = malloc(sizeof(lval*) * items->count);
 
-                    x = lval_err("Cannot Divide by Zero!");
+            for(i = 0; i < items->count; i++) {
+                lval* val = lpar_call(chunk->env, chunk->func, lval_add(lval_sexpr(), items->cell[i]));
+
+                if(val->type == LVAL_ERR) {
+                    lval_del(result);
+                    result = val;
+                    i++;
                     break;
                 }
 
-                x->num %= y->num;
+                result->cell[result->count++] = val;
             }
-            else if(strcmp(op, "^") == 0)
-                x->num = pow(x->num, y->num);
+        }
 
-            lval_del(y);
+        //Drop any items an error left unused
+        for(; i < items->count; i++) {
+            lval_del(items->cell[i]);
         }
 
-        lval_del(args);
+        items->count = 0;
+        lval_del(items);
 
-        return x;
+        chunk->items = NULL;
+        chunk->result = result;
+
+        lout = out;
     }
 
-    lval* builtin_load(lenv* env, lval* args) {
-        LASSERT_NUM("load", args, 1);
-        LASSERT_TYPE("load", args, 0, LVAL_STR);
+    //Cut list into chunks, run them across the pool and return them in order.
+    //Takes list; func stays with the caller.
+    lpar_chunk* lpar_run(lenv* env, lval* func, lval* list, int reduce, int* count) {
+        int chunks = 1;
 
-        mpc_result_t result;
+        if(list->count >= LPAR_SEQUENTIAL) {
+            chunks = lpool_threads() * LPAR_CHUNKS_PER_THREAD;
 
-        if(mpc_parse_contents(args->cell[0]->str, Lispy, &result)) {
-            //Read contents
-            lval* expr = lval_read(result.output);
-            mpc_ast_delete(result.output);
+            if(chunks > list->count / LPAR_SEQUENTIAL)
+                chunks = list->count / LPAR_SEQUENTIAL;
+        }
 
-            //Evaluate the expressions
-            while(expr->count) {
-                lval* x = lval_eval(env, lval_pop(expr, 0));
+        lpar_chunk* parts = calloc(chunks, sizeof(lpar_chunk));
+        int start = 0;
 
-                //If evaluation leads to error print it
-                if(x->type == LVAL_ERR) {
-                    lval_println(x);
-                }
+        for(int i = 0; i < chunks; i++) {
+            int end = (long)list->count * (i + 1) / chunks;
 
-                lval_del(x);
-            }
+            parts[i].task.run = lpar_chunk_run;
+            parts[i].task.cancel = lfuture_cancel;
+            parts[i].env = env;
+            parts[i].func = lval_cpy(func);
+            parts[i].reduce = reduce;
+            parts[i].out = lout;
+            parts[i].items = lval_qexpr();
+            parts[i].items->count = end - start;
+            parts[i].items->cell = malloc(sizeof(lval*) * (end - start));
+            memcpy(parts[i].items->cell, list->cell + start, sizeof(lval*) * (end - start));
 
-            //Delete the expressions and args
-            lval_del(expr);
-            lval_del(args);
+            start = end;
+        }
 
-            //Return an empty list
-            return lval_sexpr();
+        list->count = 0;
+        lval_del(list);
+
+        if(chunks == 1) {
+            lpar_chunk_run(&parts[0].task);
         } else {
-            //Get parse error as string
-            char* err_msg = mpc_err_string(result.error);
+            //Other threads read the env while chunks run
+            __atomic_add_fetch(&lthread_running, 1, __ATOMIC_ACQ_REL);
 
-            mpc_err_delete(result.error);
+            for(int i = 1; i < chunks; i++) {
+                lpool_submit(&parts[i].task);
+            }
 
-            //Create new error message
-            lval* err = lval_err("Could not load file %s", err_msg);
+            lpar_chunk_run(&parts[0].task);
 
-            //Cleanup and return error
-            free(err_msg);
-            lval_del(args);
+            for(int i = 1; i < chunks; i++) {
+                lpool_wait(&parts[i].task);
+            }
 
-            return err;
+            __atomic_sub_fetch(&lthread_running, 1, __ATOMIC_RELEASE);
+        }
+
+        for(int i = 0; i < chunks; i++) {
+            lval_del(parts[i].func);
         }
+
+        *count = chunks;
+
+        return parts;
     }
 
-    lval* builtin_print(lenv* env, lval* args) {
-        //Print each arg followed by a space
-        for(int i = 0; i < args->count; i++) {
-            lval_print(args->cell[i]);
-            putchar(' ');
+    //Like map, with the list split across the thread pool
+    lval* builtin_pmap(lenv* env, lval* args) {
+        LASSERT_NUM("pmap", args, 2);
+        LASSERT_TYPE("pmap", args, 0, LVAL_FUN);
+        LASSERT_TYPE("pmap", args, 1, LVAL_QEXPR);
+
+        lval* func = lval_pop(args, 0);
+        lval* list = lval_take(args, 0);
+
+        if(list->count == 0) {
+            lval_del(func);
+            return list;
         }
 
-        //Print a newline and delete args
-        putchar('\n');
-        lval_del(args);
+        int count;
+        lpar_chunk* parts = lpar_run(env, func, list, 0, &count);
+        lval* result = NULL;
+
+        //Join the chunks in order, or keep the first error
+        for(int i = 0; i < count; i++) {
+            lval* part = parts[i].result;
+
+            if(result && result->type == LVAL_ERR) {
+                lval_del(part);
+            } else if(!result || part->type == LVAL_ERR) {
+                if(result) lval_del(result);
+                result = part;
+            } else {
+                result->cell = realloc(result->cell, sizeof(lval*) * (result->count + part->count));
+                memcpy(result->cell + result->count, part->cell, sizeof(lval*) * part->count);
+                result->count += part->count;
+
+                part->count = 0;
+                lval_del(part);
+            }
+        }
 
-        return lval_sexpr();
+        free(parts);
+        lval_del(func);
+
+        return result;
     }
 
-    lval* builtin_err(lenv* env, lval* args) {
-        LASSERT_NUM("error", args, 1);
-        LASSERT_TYPE("error", args, 0, LVAL_STR);
+    //Like foldl for an associative func: chunks are folded in parallel and
+    //their results folded in order onto the initial value
+    lval* builtin_preduce(lenv* env, lval* args) {
+        LASSERT_NUM("preduce", args, 3);
+        LASSERT_TYPE("preduce", args, 0, LVAL_FUN);
+        LASSERT_TYPE("preduce", args, 2, LVAL_QEXPR);
+
+        lval* func = lval_pop(args, 0);
+        lval* acc = lval_pop(args, 0);
+        lval* list = lval_take(args, 0);
+
+        if(list->count == 0) {
+            lval_del(func);
+            lval_del(list);
+            return acc;
+        }
 
-        //Construct error from first arg
-        lval* err = lval_err(args->cell[0]->str);
+        int count;
+        lpar_chunk* parts = lpar_run(env, func, list, 1, &count);
+
+        for(int i = 0; i < count; i++) {
+            lval* part = parts[i].result;
+
+            if(acc->type == LVAL_ERR) {
+                lval_del(part);
+            } else if(part->type == LVAL_ERR) {
+                lval_del(acc);
+                acc = part;
+            } else {
+                acc = lpar_call(env, func, lval_add(lval_add(lval_sexpr(), acc), part));
+            }
+        }
 
-        //Delete args and return
-        lval_del(args);
+        free(parts);
+        lval_del(func);
 
-        return err;
+        return acc;
     }
 
-    lval* builtin_head(lenv* env, lval* val) {
-        //Check error conditions
-        LASSERT(val, val->count == 1, "Argument Error: Function 'head' was passed too many arguments. Got: %i Expected: %i", val->count, 1);
-        LASSERT(val, val->cell[0]->type == LVAL_QEXPR, "Type Error: Function 'head' expects type Q-Expression. Got: %s Expected: %s", ltype_name(val->cell[0]->type), ltype_name(LVAL_QEXPR));
-        LASSERT(val, val->cell[0]->count != 0, "Empty Expression: Function 'head' expects at least one value. Passed: {}");
+/* Future Builtins */
+    //A Q-Expression evaluated on the thread pool, or for future-all a list
+    //of futures gathered into one. The pool holds a reference until the
+    //task has run, as do the handle values.
+    struct lfuture {
+        ltask task;
+        int refs;
+        int cancelled;
 
-        //Otherwise take first arg
-        lval* newVal = lval_take(val, 0);
+        lenv* env;
+        lval* expr;
+        lval* futures;
+        lval* result;
+    };
 
-        //Delete all elements that are not the head and return
-        while(newVal->count > 1) {
-            lval_del(lval_pop(newVal, 1));
+    //Copy the local envs from env up to the shared global env, so a future
+    //keeps the variables it can see however long it runs
+    lenv* lenv_snapshot(lenv* env) {
+        if(!env || env->lock)
+            return env;
+
+        lenv* cpy = lenv_cpy(env);
+        cpy->parent = lenv_snapshot(env->parent);
+
+        return cpy;
+    }
+
+    void lenv_snapshot_del(lenv* env) {
+        while(env && !env->lock) {
+            lenv* parent = env->parent;
+            lenv_del(env);
+            env = parent;
         }
+    }
 
-        return newVal;
+    void lfuture_release(lfuture* future) {
+        if(LREF_DEC(future->refs) > 0)
+            return;
+
+        if(future->futures)
+            lval_del(future->futures);
+
+        lval_del(future->result);
+        free(future);
     }
 
-    lval* builtin_tail(lenv* env, lval* val) {
-        //Check error conditions
-        LASSERT(val, val->count == 1, "Argument Error: Function 'tail' was passed too many arguments. Got: %i Expected: %i", val->count, 1);
-        LASSERT(val, val->cell[0]->type == LVAL_QEXPR, "Type Error: Function 'tail' expects type Q-Expression. Got: %s Expected: %s", ltype_name(val->cell[0]->type), ltype_name(LVAL_QEXPR));
-        LASSERT(val, val->cell[0]->count != 0, "Empty Expression: Function 'tail' expects at least one value. Passed: {}");
+    void lfuture_task_release(ltask* task) {
+        lfuture_release((lfuture*)task);
+    }
 
-        //Otherwise take first arg
-        lval* newVal = lval_take(val, 0);
+    //Wait for a future, running queued tasks meanwhile
+    lval* lfuture_await(lfuture* future) {
+        lpool_wait(&future->task);
+        return lval_cpy(future->result);
+    }
 
-        //Delete the first and return
-        lval_del(lval_pop(newVal, 0));
+    void lfuture_run(ltask* task) {
+        lfuture* future = (lfuture*)task;
 
-        return newVal;
+        if(__atomic_load_n(&future->cancelled, __ATOMIC_RELAXED)) {
+            //The expression is only consumed by evaluating it
+            if(future->expr)
+                lval_del(future->expr);
+
+            future->result = lval_err("Future cancelled");
+        } else if(future->expr) {
+            future->result = lval_eval(future->env, future->expr);
+        } else {
+            //Gather each future's result, or the first error
+            lval* results = lval_qexpr();
+
+            for(int i = 0; i < future->futures->count; i++) {
+                lval* result = lfuture_await(future->futures->cell[i]->future);
+
+                if(result->type == LVAL_ERR) {
+                    lval_del(results);
+                    results = result;
+                    break;
+                }
+
+                lval_add(results, result);
+            }
+
+            future->result = results;
+        }
+
+        if(future->expr) {
+            lenv_snapshot_del(future->env);
+            future->expr = NULL;
+        }
+
+        //Done with the global env
+        __atomic_sub_fetch(&lthread_running, 1, __ATOMIC_RELEASE);
     }
 
-    lval* builtin_list(lenv* env, lval* val) {
-        val->type = LVAL_QEXPR;
-        return val;
+    lval* lfuture_start(lenv* env, lval* expr, lval* futures) {
+        lfuture* future = calloc(1, sizeof(lfuture));
+
+        future->task.run = lfuture_run;
+        future->task.cancel = &future->cancelled;
+        future->task.release = lfuture_task_release;
+        future->refs = 2;
+        future->env = env;
+        future->expr = expr;
+        future->futures = futures;
+
+        lpool_threads();
+        __atomic_add_fetch(&lthread_running, 1, __ATOMIC_ACQ_REL);
+        lpool_submit(&future->task);
+
+        return lval_future(future);
     }
 
-    lval* builtin_eval(lenv* env, lval* val) {
-        LASSERT(val, val->count == 1, "Argument Error: Function 'eval' passed too many arguments. Got: %i Expected: %i", val->count, 1);
-        LASSERT(val, val->cell[0]->type == LVAL_QEXPR, "Type Error: Function 'eval' expects type Q-Expression. Got: %s Expected: %s", ltype_name(val->cell[0]->type), ltype_name(LVAL_QEXPR));
+    //Evaluate a Q-Expression on the thread pool. It sees a copy of the
+    //caller's local variables and the shared global env.
+    lval* builtin_future(lenv* env, lval* args) {
+        LASSERT_NUM("future", args, 1);
+        LASSERT_TYPE("future", args, 0, LVAL_QEXPR);
 
-        lval* result = lval_take(val, 0);
-        result->type = LVAL_SEXPR;
+        lval* expr = lval_take(args, 0);
+        expr->type = LVAL_SEXPR;
 
-        return lval_eval(env, result);
+        return lfuture_start(lenv_snapshot(env), expr, NULL);
     }
 
-    lval* lval_join(lenv* env, lval* exp1, lval* exp2) {
-        //For each cell in 'exp2' add it to 'exp1'
-        while(exp2->count) {
-            exp1 = lval_add(exp1, lval_pop(exp2, 0));
+    //A future for the Q-Expression of results of a list of futures
+    lval* builtin_future_all(lenv* env, lval* args) {
+        LASSERT_NUM("future-all", args, 1);
+        LASSERT_TYPE("future-all", args, 0, LVAL_QEXPR);
+
+        for(int i = 0; i < args->cell[0]->count; i++) {
+            LASSERT(args, args->cell[0]->cell[i]->type == LVAL_FUTURE,
+                "Function 'future-all' passed incorrect type in list. Got %s, Expected %s.",
+                ltype_name(args->cell[0]->cell[i]->type), ltype_name(LVAL_FUTURE));
         }
 
-        //Delete the empty 'exp2'
-        lval_del(exp2);
+        return lfuture_start(NULL, NULL, lval_take(args, 0));
+    }
 
-        return exp1;
+    //Block until a future is done and return its result, errors included
+    lval* builtin_await(lenv* env, lval* args) {
+        LASSERT_NUM("await", args, 1);
+        LASSERT_TYPE("await", args, 0, LVAL_FUTURE);
+
+        lval* result = lfuture_await(args->cell[0]->future);
+        lval_del(args);
+
+        return result;
     }
 
-    lval* lval_call(lenv* env, lval* func, lval* args) {
-        //If builtin, then simply apply that
-        if(func->builtin) {
-            return func->builtin(env, args);
-        }
+    //Stop a future before its next function call, or before it starts.
+    //Cancelling future-all cancels the futures it gathers. Returns 1 if
+    //the future had not finished.
+    lval* builtin_cancel(lenv* env, lval* args) {
+        LASSERT_NUM("cancel", args, 1);
+        LASSERT_TYPE("cancel", args, 0, LVAL_FUTURE);
 
-        //Record arg counts
-        int given = args->count;
-        int total = func->formals->count;
+        lfuture* future = args->cell[0]->future;
+        int pending = !__atomic_load_n(&future->task.done, __ATOMIC_ACQUIRE);
 
-        //While args still remain to be processed
-        while(args->count) {
-            //If we run out of formal args to bind
-            if(func->formals->count == 0) {
-                lval_del(args);
-                return lval_err("Function passed too many arguments. Got %i, Expected %i", given, total);
+        __atomic_store_n(&future->cancelled, 1, __ATOMIC_RELAXED);
+
+        if(pending && future->futures) {
+            for(int i = 0; i < future->futures->count; i++) {
+                __atomic_store_n(&future->futures->cell[i]->future->cancelled, 1, __ATOMIC_RELAXED);
             }
+        }
 
-            //Pop the first symbol from the formals
-            lval* sym = lval_pop(func->formals, 0);
+        lval_del(args);
 
-            //Pop the next arg from the list
-            lval* val = lval_pop(args, 0);
+        return lval_num(pending);
+    }
 
-            //Bind a copy into the function's env
-            lenv_set(func->env, sym, val);
+/* Isolate Builtins */
+    //An isolate is a thread with its own global env, loaded from the stdlib,
+    //sharing nothing with other isolates. They talk by sending messages,
+    //values serialized into a buffer, through a mailbox that many threads
+    //push to and only the owner pops from. The main thread gets a mailbox
+    //too, on first use.
+    typedef struct lmsg {
+        struct lmsg* next;
+        lwire wire;
+    } lmsg;
+
+    struct lisolate {
+        int refs;
+
+        //Intrusive lock-free MPSC queue: senders swap themselves in at head,
+        //the owner pops from tail. stub keeps the queue from going empty.
+        lmsg* head;
+        lmsg* tail;
+        lmsg stub;
+
+        //The owner sleeps here when the queue is empty
+        pthread_mutex_t lock;
+        pthread_cond_t arrived;
+        int sleeping;
+
+        pthread_rwlock_t envLock;
+        lval* code;
+    };
 
-            //Delete symbol and value
-            lval_del(sym);
+    __thread lisolate* lisolate_self = NULL;
+
+    //Isolate threads that haven't finished, which main doesn't wait for
+    int lisolate_running = 0;
+
+    void lmsg_del(lmsg* msg) {
+        //Release any isolate references the message carries
+        lwire_in in = { msg->wire.data, msg->wire.data + msg->wire.len, NULL, 1 };
+        lval* val = lser_read(&in);
+
+        if(val)
             lval_del(val);
-        }
 
-        //The arg list has been bound and can be cleaned up
-        lval_del(args);
+        free(msg->wire.data);
+        free(msg);
+    }
 
-        //If all formals have been bound, evaluate
-        if(func->formals->count == 0) {
-            //Set env parent to evaluation env
-            func->env->parent = env;
+    void lisolate_push(lisolate* iso, lmsg* msg) {
+        msg->next = NULL;
 
-            //Evaluate and return
-            return builtin_eval(func->env, lval_add(lval_sexpr(), lval_cpy(func->body)));
-        } else {
-            //Otherwise return partially evaluated function
-            return lval_cpy(func);
-        }
+        lmsg* prev = __atomic_exchange_n(&iso->head, msg, __ATOMIC_ACQ_REL);
+        __atomic_store_n(&prev->next, msg, __ATOMIC_RELEASE);
     }
 
-    lval* builtin_join(lenv* env, lval* val) {
-        for(int i = 0; i < val->count; i++) {
-            LASSERT(val, val->cell[0]->type == LVAL_QEXPR, "Type Error: Function 'join' expects type Q-Expression. Got: %s", ltype_name(val->cell[0]->type));
+    //Take the oldest message, or NULL if there is none or a sender is
+    //midway through pushing one
+    lmsg* lisolate_pop(lisolate* iso) {
+        lmsg* tail = iso->tail;
+        lmsg* next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+        if(tail == &iso->stub) {
+            if(!next)
+                return NULL;
+
+            iso->tail = next;
+            tail = next;
+            next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
         }
 
-        lval* result = lval_pop(val, 0);
+        if(next) {
+            iso->tail = next;
+            return tail;
+        }
 
-        while(val->count) {
-            result = lval_join(env, result, lval_pop(val, 0));
+        if(tail != __atomic_load_n(&iso->head, __ATOMIC_ACQUIRE))
+            return NULL;
+
+        //tail is the last message, put the stub behind it to take it
+        lisolate_push(iso, &iso->stub);
+        next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+        if(next) {
+            iso->tail = next;
+            return tail;
         }
 
-        lval_del(val);
+        return NULL;
+    }
 
-        return result;
+    lisolate* lisolate_new(void) {
+        lisolate* iso = calloc(1, sizeof(lisolate));
+
+        iso->refs = 1;
+        iso->head = &iso->stub;
+        iso->tail = &iso->stub;
+        pthread_mutex_init(&iso->lock, NULL);
+        pthread_cond_init(&iso->arrived, NULL);
+        pthread_rwlock_init(&iso->envLock, NULL);
+
+        return iso;
     }
 
-    lval* builtin_var(lenv* env, lval* val, char* func) {
-        LASSERT(val, val->cell[0]->type == LVAL_QEXPR, "Type Error: Function '%s' expects type Q-Expression. Got: %s", func, ltype_name(val->cell[0]->type));
+    void lisolate_retain(lisolate* iso) {
+        LREF_INC(iso->refs);
+    }
 
-        //First arg in symbol list
-        lval* syms = val->cell[0];
+    void lisolate_release(lisolate* iso) {
+        if(LREF_DEC(iso->refs) > 0)
+            return;
 
-        //Ensure all elements are symbols
-        for(int i = 0; i < syms->count; i++) {
-            LASSERT(val, syms->cell[i]->type == LVAL_SYM, "Define Error: Function '%s' cannot define non-symbol. Got: %s Expected: %s", func, ltype_name(syms->cell[i]->type), ltype_name(LVAL_SYM));
+        for(lmsg* msg; (msg = lisolate_pop(iso));) {
+            lmsg_del(msg);
         }
 
-        //Check correct number of symbols and vals
-        LASSERT(val, syms->count == val->count - 1, "Define Error: Function '%s' expects equal number of values to symbols. Got: %i Expected: %i", func, syms->count, val->count-1);
+        pthread_mutex_destroy(&iso->lock);
+        pthread_cond_destroy(&iso->arrived);
+        pthread_rwlock_destroy(&iso->envLock);
+        free(iso);
+    }
 
-        //Assign copies of vals to symbols
-        for(int i = 0; i < syms->count; i++) {
-            //If def define globally, if put define locally
-            if(strcmp(func, "def") == 0) {
-                lenv_def(env, syms->cell[i], val->cell[i+1]);
-            } else if(strcmp(func, "=") == 0) {
-                lenv_set(env, syms->cell[i], val->cell[i+1]);
+    //The calling thread's isolate, made for it if it has none
+    lisolate* lisolate_current(void) {
+        if(!lisolate_self)
+            lisolate_self = lisolate_new();
+
+        return lisolate_self;
+    }
+
+    //Pop a message, waiting up to ms milliseconds for one, or forever if
+    //ms is negative
+    lmsg* lisolate_receive(lisolate* iso, long ms) {
+        lmsg* msg = lisolate_pop(iso);
+
+        if(msg || ms == 0)
+            return msg;
+
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += ms / 1000;
+        until.tv_nsec += (ms % 1000) * 1000000;
+
+        if(until.tv_nsec >= 1000000000) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000;
+        }
+
+        pthread_mutex_lock(&iso->lock);
+
+        //Senders check sleeping after pushing, so announce it before the
+        //last look at the queue
+        __atomic_store_n(&iso->sleeping, 1, __ATOMIC_SEQ_CST);
+
+        while(!(msg = lisolate_pop(iso))) {
+            int status = (ms < 0) ? pthread_cond_wait(&iso->arrived, &iso->lock)
+                                  : pthread_cond_timedwait(&iso->arrived, &iso->lock, &until);
+
+            if(status != 0) {
+                msg = lisolate_pop(iso);
+                break;
             }
         }
 
-        lval_del(val);
-        return lval_sexpr();
-    }
+        __atomic_store_n(&iso->sleeping, 0, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&iso->lock);
 
-    lval* builtin_def(lenv* env, lval* args) {
-        return builtin_var(env, args, "def");
+        return msg;
     }
 
-    lval* builtin_put(lenv* env, lval* args) {
-        return builtin_var(env, args, "=");
+    void lisolate_send(lisolate* iso, lmsg* msg) {
+        lisolate_push(iso, msg);
+
+        if(__atomic_load_n(&iso->sleeping, __ATOMIC_SEQ_CST)) {
+            pthread_mutex_lock(&iso->lock);
+            pthread_cond_signal(&iso->arrived);
+            pthread_mutex_unlock(&iso->lock);
+        }
     }
 
-    lval* builtin_lambda(lenv* env, lval* args) {
-        //Check two args each of which are Q-Exprs
-        LASSERT_NUM("\\", args, 2);
-        LASSERT_TYPE("\\", args, 0, LVAL_QEXPR);
-        LASSERT_TYPE("\\", args, 1, LVAL_QEXPR);
+    void* lisolate_main(void* arg) {
+        lisolate* iso = arg;
+        lisolate_self = iso;
 
-        //Check first expression contains only symbols
-        for(int i = 0; i < args->cell[0]->count; i++) {
-            LASSERT(
-                args,
-                (args->cell[0]->cell[i]->type == LVAL_SYM),
-                "Cannot define non-symbol. Got %s, Expected %s",
-                ltype_name(args->cell[0]->cell[i]->type),
-                ltype_name(LVAL_SYM)
-            );
+        lenv* env = lenv_new();
+        env->lock = &iso->envLock;
+        lenv_add_builtins(env);
+
+        lval* std = builtin_load(env, lval_add(lval_sexpr(), lval_str("stdlib.dlsp")));
+        lval_del(std);
+
+        //Evaluate the code in turn, printing errors as load does
+        lval* code = iso->code;
+        iso->code = NULL;
+
+        while(code->count) {
+            lval* x = lval_eval(env, lval_pop(code, 0));
+
+            if(x->type == LVAL_ERR)
+                lval_println(x);
+
+            lval_del(x);
         }
 
-        //Pop first 2 args and pass to lval_lambda
-        lval* formals = lval_pop(args, 0);
-        lval* body = lval_pop(args, 0);
-        lval_del(args);
+        lval_del(code);
+        lenv_del(env);
 
-        return lval_lambda(formals, body);
-    }
+        lisolate_self = NULL;
+        lisolate_release(iso);
 
-/* Arithemetic Builtins */
-    lval* builtin_add(lenv* env, lval* args) {
-        return builtin_op(env, args, "+");
-    }
+        lstats_flush();
+        lheap_drain();
 
-    lval* builtin_sub(lenv* env, lval* args) {
-        return builtin_op(env, args, "-");
-    }
+        __atomic_sub_fetch(&lisolate_running, 1, __ATOMIC_RELEASE);
 
-    lval* builtin_mult(lenv* env, lval* args) {
-        return builtin_op(env, args, "*");
+        return NULL;
     }
 
-    lval* builtin_div(lenv* env, lval* args) {
-        return builtin_op(env, args, "/");
-    }
+    //Start an isolate evaluating each expression of a Q-Expression in turn
+    lval* builtin_isolate_new(lenv* env, lval* args) {
+        LASSERT_NUM("isolate-new", args, 1);
+        LASSERT_TYPE("isolate-new", args, 0, LVAL_QEXPR);
 
-    lval* builtin_pow(lenv* env, lval* args) {
-        return builtin_op(env, args, "^");
-    }
+        //Pass the code over serialized, so no storage is shared with it
+        lwire wire = { NULL, 0, 0, 1, 0 };
 
-    lval* builtin_mod(lenv* env, lval* args) {
-        return builtin_op(env, args, "%");
-    }
+        if(!lser_write(&wire, args->cell[0])) {
+            lval* err = lval_err("Function 'isolate-new' cannot pass a %s to an isolate.", ltype_name(wire.bad));
 
-    lval* builtin(lenv* env, lval* val, char* func) {
-        if (strcmp("list", func) == 0) { return builtin_list(env, val); }
-        if (strcmp("head", func) == 0) { return builtin_head(env, val); }
-        if (strcmp("tail", func) == 0) { return builtin_tail(env, val); }
-        if (strcmp("join", func) == 0) { return builtin_join(env, val); }
-        if (strcmp("eval", func) == 0) { return builtin_eval(env, val); }
-        if (strstr("+-/*^", func)) { return builtin_op(env, val, func); }
+            free(wire.data);
+            lval_del(args);
 
-        lval_del(val);
+            return err;
+        }
 
-        return lval_err("Unknown Function!");
-    }
+        lisolate* iso = lisolate_new();
+        lwire_in in = { wire.data, wire.data + wire.len, NULL, 1 };
+        iso->code = lser_read(&in);
+        iso->refs = 2;
+        free(wire.data);
 
-/* Conditional Builtins */
-    lval* builtin_ord(lenv* env, lval* args, char* op) {
-        //Ensure all args are numbers
-        LASSERT_NUM(op, args, 2);
-        LASSERT_TYPE(op, args, 0, LVAL_NUM);
-        LASSERT_TYPE(op, args, 1, LVAL_NUM);
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setstacksize(&attr, LTHREAD_STACK);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
 
-        int cmpResult = 0;
+        __atomic_add_fetch(&lisolate_running, 1, __ATOMIC_ACQ_REL);
 
-        if(strcmp(op, ">") == 0) {
-            cmpResult = (args->cell[0]->num > args->cell[1]->num);
-        }
+        pthread_t id;
+        int failed = pthread_create(&id, &attr, lisolate_main, iso);
+        pthread_attr_destroy(&attr);
+        lval_del(args);
 
-        if(strcmp(op, ">=") == 0) {
-            cmpResult = (args->cell[0]->num >= args->cell[1]->num);
-        }
+        if(failed) {
+            __atomic_sub_fetch(&lisolate_running, 1, __ATOMIC_RELEASE);
 
-        if(strcmp(op, "<") == 0) {
-            cmpResult = (args->cell[0]->num < args->cell[1]->num);
+            lval_del(iso->code);
+            iso->refs = 1;
+            lisolate_release(iso);
+
+            return lval_err("Function 'isolate-new' could not start a thread.");
         }
 
-        if(strcmp(op, "<=") == 0) {
-            cmpResult = (args->cell[0]->num <= args->cell[1]->num);
+        return lval_isolate(iso);
+    }
+
+    //Send a copy of a value to an isolate's mailbox
+    lval* builtin_send(lenv* env, lval* args) {
+        LASSERT_NUM("send", args, 2);
+        LASSERT_TYPE("send", args, 0, LVAL_ISOLATE);
+
+        lmsg* msg = malloc(sizeof(lmsg));
+        msg->wire = (lwire){ NULL, 0, 0, 1, 0 };
+
+        if(!lser_write(&msg->wire, args->cell[1])) {
+            lval* err = lval_err("Function 'send' cannot send a %s.", ltype_name(msg->wire.bad));
+
+            free(msg->wire.data);
+            free(msg);
+            lval_del(args);
+
+            return err;
         }
 
+        lisolate_send(args->cell[0]->isolate, msg);
         lval_del(args);
 
-        return lval_num(cmpResult);
+        return lval_sexpr();
     }
 
-    lval* builtin_gt(lenv* env, lval* args) {
-        return builtin_ord(env, args, ">");
-    }
+    //Wait up to a number of milliseconds, or forever if negative, for a
+    //message. Returns {message}, or {} on timeout.
+    lval* builtin_receive(lenv* env, lval* args) {
+        LASSERT_NUM("receive", args, 1);
+        LASSERT_TYPE("receive", args, 0, LVAL_NUM);
 
-    lval* builtin_gte(lenv* env, lval* args) {
-        return builtin_ord(env, args, ">=");
-    }
+        lmsg* msg = lisolate_receive(lisolate_current(), args->cell[0]->num);
+        lval_del(args);
 
-    lval* builtin_lt(lenv* env, lval* args) {
-        return builtin_ord(env, args, "<");
+        lval* result = lval_qexpr();
+
+        if(msg) {
+            lwire_in in = { msg->wire.data, msg->wire.data + msg->wire.len, NULL, 1 };
+            lval_add(result, lser_read(&in));
+
+            free(msg->wire.data);
+            free(msg);
+        }
+
+        return result;
     }
 
-    lval* builtin_lte(lenv* env, lval* args) {
-        return builtin_ord(env, args, "<=");
+    //The calling isolate, to pass to others so they can reply
+    lval* builtin_self(lenv* env, lval* args) {
+        lisolate* iso = lisolate_current();
+        lval_del(args);
+
+        lisolate_retain(iso);
+
+        return lval_isolate(iso);
     }
 
-    int lval_eq(lval* x, lval* y) {
-        /* Different types are always unequal */
-        if(x->type != y->type)
-            return 0;
+/* Statistics Builtins */
+    //Builds {name count} pairs for every counter
+    lval* lstats_list(void) {
+        lval* list = lval_qexpr();
+        lstats_counters total = lstats_total();
 
-        //Compare base upon type
-        switch(x->type) {
-            //Compare num value
-            case LVAL_NUM:
-                return x->num == y->num;
+        char* names[] = { "evals", "lookups", "lookup-depth", "cache-hits", "copies", "copy-bytes" };
+        long counts[] = { total.evals, total.lookups, total.lookupDepth, total.cacheHits, total.copies, total.copyBytes };
 
-            //Compare string vals
-            case LVAL_ERR:
-                return (strcmp(x->err, y->err) == 0);
-            case LVAL_SYM:
-                return (strcmp(x->symbol, y->symbol) == 0);
+        for(int i = 0; i < 6; i++) {
+            lval* pair = lval_add(lval_qexpr(), lval_sym(names[i]));
+            lval_add(list, lval_add(pair, lval_num(counts[i])));
+        }
 
-            //If builtin compare, otherwise compare formals and body
-            case LVAL_FUN:
-                if(x->builtin || y->builtin)
-                    return x->builtin == y->builtin;
-                else
-                    return lval_eq(x->formals, y->formals) && lval_eq(x->body, y->body);
+        //Allocations and frees are broken down by type name
+        lval* allocs = lval_qexpr();
+        lval* frees = lval_qexpr();
 
-            //If list compare each element
-            case LVAL_QEXPR:
-            case LVAL_SEXPR:
-                //First check num of elements
-                if(x->count != y->count)
-                    return 0;
+        for(int type = 0; type < LVAL_TYPE_COUNT; type++) {
+            lval* alloc = lval_add(lval_qexpr(), lval_str(ltype_name(type)));
+            lval_add(allocs, lval_add(alloc, lval_num(total.allocs[type])));
 
-                for(int i = 0; i < x->count; i++) {
-                    //If any element is not equal then bail
-                    if(!lval_eq(x->cell[i], y->cell[i]))
-                        return 0;
-                }
+            lval* free = lval_add(lval_qexpr(), lval_str(ltype_name(type)));
+            lval_add(frees, lval_add(free, lval_num(total.frees[type])));
+        }
 
-                //Otherwise lists must be equal
-                return 1;
+        lval_add(list, lval_add(lval_add(lval_qexpr(), lval_sym("allocs")), allocs));
+        lval_add(list, lval_add(lval_add(lval_qexpr(), lval_sym("frees")), frees));
 
-            case LVAL_STR:
-                return (strcmp(x->str, y->str) == 0);
+        //Calls per builtin that has been called
+        lval* builtins = lval_qexpr();
 
-            break;
+        for(int i = 0; i < LSTATS_BUILTINS; i++) {
+            if(!total.calls[i]) continue;
+
+            lval* call = lval_add(lval_qexpr(), lval_str(lstats_builtins[i].name));
+            lval_add(builtins, lval_add(call, lval_num(total.calls[i])));
         }
 
-        //If we're here, bail since something went wrong
-        return 0;
+        lval_add(list, lval_add(lval_add(lval_qexpr(), lval_sym("builtins")), builtins));
+
+        return list;
     }
 
-    lval* builtin_cmp(lenv* env, lval* args, char* op) {
-        LASSERT_NUM(op, args, 2);
+    //Returns the counters named in the Q-Expression argument, or all for {}
+    lval* builtin_stats(lenv* env, lval* args) {
+        LASSERT_NUM("stats", args, 1);
+        LASSERT_TYPE("stats", args, 0, LVAL_QEXPR);
 
-        int cmpResult = 0;
+        lval* list = lstats_list();
+        lval* names = args->cell[0];
 
-        if(strcmp(op, "==") == 0) {
-            cmpResult = lval_eq(args->cell[0], args->cell[1]);
+        if(names->count == 0) {
+            lval_del(args);
+            return list;
         }
 
-        if(strcmp(op, "!=") == 0) {
-            cmpResult = !lval_eq(args->cell[0], args->cell[1]);
+        lval* result = lval_qexpr();
+
+        for(int i = 0; i < names->count; i++) {
+            for(int j = 0; j < list->count; j++) {
+                if(lval_eq(names->cell[i], list->cell[j]->cell[0])) {
+                    lval_add(result, lval_pop(list, j));
+                    break;
+                }
+            }
         }
 
+        lval_del(list);
         lval_del(args);
 
-        return lval_num(cmpResult);
+        return result;
     }
 
-    lval* builtin_eq(lenv* env, lval* args) {
-        return builtin_cmp(env, args, "==");
-    }
+    //Prints every counter to stderr, used by --stats on exit
+    void lstats_report(void) {
+        lstats_counters total = lstats_total();
+        long allocs = 0;
+        long frees = 0;
 
-    lval* builtin_ne(lenv* env, lval* args) {
-        return builtin_cmp(env, args, "!=");
-    }
+        fprintf(stderr, "\nInterpreter stats\n");
+        fprintf(stderr, "  %-14s %12li\n", "evals", total.evals);
+        fprintf(stderr, "  %-14s %12li\n", "lookups", total.lookups);
+        fprintf(stderr, "  %-14s %12li\n", "lookup depth", total.lookupDepth);
+        fprintf(stderr, "  %-14s %12li\n", "cache hits", total.cacheHits);
+        fprintf(stderr, "  %-14s %12li\n", "copies", total.copies);
+        fprintf(stderr, "  %-14s %12li\n", "copy bytes", total.copyBytes);
 
-    lval* builtin_if(lenv* env, lval* args) {
-        LASSERT_NUM("if", args, 3);
-        LASSERT_TYPE("if", args, 0, LVAL_NUM);
-        LASSERT_TYPE("if", args, 1, LVAL_QEXPR);
-        LASSERT_TYPE("if", args, 2, LVAL_QEXPR);
-
-        //Mark both expressions as evaluable
-        lval* x;
-        args->cell[1]->type = LVAL_SEXPR;
-        args->cell[2]->type = LVAL_SEXPR;
-
-        if(args->cell[0]->num) {
-            //If condition is true evaluate first expression
-            x = lval_eval(env, lval_pop(args, 1));
-        } else {
-            //Otherwise evaluate second expression
-            x = lval_eval(env, lval_pop(args, 2));
+        fprintf(stderr, "\n  %-14s %12s %12s\n", "type", "allocated", "freed");
+
+        for(int type = 0; type < LVAL_TYPE_COUNT; type++) {
+            fprintf(stderr, "  %-14s %12li %12li\n", ltype_name(type), total.allocs[type], total.frees[type]);
+
+            allocs += total.allocs[type];
+            frees += total.frees[type];
         }
 
-        //Delete argument list and return
-        lval_del(args);
+        fprintf(stderr, "  %-14s %12li %12li\n", "total", allocs, frees);
 
-        return x;
+        fprintf(stderr, "\n  %-14s %12s\n", "builtin", "calls");
+
+        for(int i = 0; i < LSTATS_BUILTINS; i++) {
+            if(total.calls[i])
+                fprintf(stderr, "  %-14s %12li\n", lstats_builtins[i].name, total.calls[i]);
+        }
     }
 
 /* Add builtins to the environment */
@@ -1000,9 +6716,19 @@ void add_history(char* unused) {}
         lval* k = lval_sym(name);
         lval* v = lval_fun(func);
 
+        //Report calls under the first name a builtin is given
+        lstats_builtin* slot = &lstats_builtins[lstats_builtin_slot(func)];
+
+        if(!slot->func) {
+            slot->func = func;
+            slot->name = name;
+        }
+
         lenv_set(env, k, v);
         lval_del(k);
         lval_del(v);
+
+        lopt_reserve(name);
     }
 
     void lenv_add_builtins(lenv* env) {
@@ -1032,8 +6758,16 @@ void add_history(char* unused) {}
         lenv_add_builtin(env, "def", builtin_def);
         lenv_add_builtin(env, "=", builtin_put);
 
-        //Comparison Functions
+        //Special Forms
         lenv_add_builtin(env, "if", builtin_if);
+        lenv_add_builtin(env, "do", builtin_do);
+        lenv_add_builtin(env, "let", builtin_let);
+        lenv_add_builtin(env, "select", builtin_select);
+        lenv_add_builtin(env, "case", builtin_case);
+        lenv_add_builtin(env, "and", builtin_and);
+        lenv_add_builtin(env, "or", builtin_or);
+
+        //Comparison Functions
         lenv_add_builtin(env, "==", builtin_eq);
         lenv_add_builtin(env, "!=", builtin_ne);
         lenv_add_builtin(env, ">",  builtin_gt);
@@ -1045,11 +6779,112 @@ void add_history(char* unused) {}
         lenv_add_builtin(env, "load", builtin_load);
         lenv_add_builtin(env, "error", builtin_err);
         lenv_add_builtin(env, "print", builtin_print);
+        lenv_add_builtin(env, "stats", builtin_stats);
+        lenv_add_builtin(env, "str-join", builtin_str_join);
+        lenv_add_builtin(env, "str-len", builtin_str_len);
+        lenv_add_builtin(env, "substr", builtin_substr);
+        lenv_add_builtin(env, "str-find", builtin_str_find);
+        lenv_add_builtin(env, "str-split", builtin_str_split);
+        lenv_add_builtin(env, "str->num", builtin_str_num);
+        lenv_add_builtin(env, "to-string", builtin_to_string);
+        lenv_add_builtin(env, "serialize", builtin_serialize);
+        lenv_add_builtin(env, "deserialize", builtin_deserialize);
+
+        //Lazy Sequence Functions
+        lenv_add_builtin(env, "range", builtin_range);
+        lenv_add_builtin(env, "lazy-map", builtin_lazy_map);
+        lenv_add_builtin(env, "lazy-filter", builtin_lazy_filter);
+        lenv_add_builtin(env, "lazy-take", builtin_lazy_take);
+        lenv_add_builtin(env, "lazy-fold", builtin_lazy_fold);
+        lenv_add_builtin(env, "realize", builtin_realize);
+
+        //File Functions
+        lenv_add_builtin(env, "open", builtin_open);
+        lenv_add_builtin(env, "read-line", builtin_read_line);
+        lenv_add_builtin(env, "read-chunk", builtin_read_chunk);
+        lenv_add_builtin(env, "write", builtin_write);
+        lenv_add_builtin(env, "close", builtin_close);
+        lenv_add_builtin(env, "fold-lines", builtin_fold_lines);
+
+        //Vector Functions
+        lenv_add_builtin(env, "vec", builtin_vec);
+        lenv_add_builtin(env, "vec-list", builtin_vec_list);
+        lenv_add_builtin(env, "vec-len", builtin_vec_len);
+        lenv_add_builtin(env, "vec-nth", builtin_vec_nth);
+        lenv_add_builtin(env, "vec-slice", builtin_vec_slice);
+        lenv_add_builtin(env, "vec+", builtin_vec_add);
+        lenv_add_builtin(env, "vec-", builtin_vec_sub);
+        lenv_add_builtin(env, "vec*", builtin_vec_mult);
+        lenv_add_builtin(env, "vec/", builtin_vec_div);
+        lenv_add_builtin(env, "vec-sum", builtin_vec_sum);
+        lenv_add_builtin(env, "vec-min", builtin_vec_min);
+        lenv_add_builtin(env, "vec-max", builtin_vec_max);
+        lenv_add_builtin(env, "vec-dot", builtin_vec_dot);
+
+        //Hash Map Functions
+        lenv_add_builtin(env, "hash-new", builtin_hash_new);
+        lenv_add_builtin(env, "hash-get", builtin_hash_get);
+        lenv_add_builtin(env, "hash-has", builtin_hash_has);
+        lenv_add_builtin(env, "hash-put", builtin_hash_put);
+        lenv_add_builtin(env, "hash-del", builtin_hash_del);
+        lenv_add_builtin(env, "hash-len", builtin_hash_len);
+        lenv_add_builtin(env, "hash-keys", builtin_hash_keys);
+        lenv_add_builtin(env, "hash-items", builtin_hash_items);
+
+        //Dict Functions
+        lenv_add_builtin(env, "dict", builtin_dict);
+        lenv_add_builtin(env, "dict-get", builtin_dict_get);
+        lenv_add_builtin(env, "dict-has", builtin_dict_has);
+        lenv_add_builtin(env, "assoc", builtin_assoc);
+        lenv_add_builtin(env, "dissoc", builtin_dissoc);
+        lenv_add_builtin(env, "dict-len", builtin_dict_len);
+        lenv_add_builtin(env, "dict-keys", builtin_dict_keys);
+        lenv_add_builtin(env, "dict-items", builtin_dict_items);
+
+        //Memo Functions
+        lenv_add_builtin(env, "memo", builtin_memo);
+        lenv_add_builtin(env, "memo-stats", builtin_memo_stats);
+
+        //Thread Functions
+        lenv_add_builtin(env, "spawn", builtin_spawn);
+        lenv_add_builtin(env, "pmap", builtin_pmap);
+        lenv_add_builtin(env, "preduce", builtin_preduce);
+
+        //Future Functions
+        lenv_add_builtin(env, "future", builtin_future);
+        lenv_add_builtin(env, "future-all", builtin_future_all);
+        lenv_add_builtin(env, "await", builtin_await);
+        lenv_add_builtin(env, "cancel", builtin_cancel);
+
+        //Isolate Functions
+        lenv_add_builtin(env, "isolate-new", builtin_isolate_new);
+        lenv_add_builtin(env, "send", builtin_send);
+        lenv_add_builtin(env, "receive", builtin_receive);
+        lenv_add_builtin(env, "self", builtin_self);
+
+        //Defined by stdlib.dlsp, but fixed from the start when optimizing
+        lopt_reserve("nil");
+        lopt_reserve("true");
+        lopt_reserve("false");
     }
 
     lval* lval_eval_sexpr(lenv* env, lval* val) {
+        //Special forms get their arguments unevaluated
+        if(val->count > 1) {
+            val->cell[0] = lval_eval(env, val->cell[0]);
+            lform form = lform_of(val->cell[0]);
+
+            if(form) {
+                lstats.calls[lstats_builtin_slot(val->cell[0]->builtin)]++;
+                lval* result = form(env, val->cell + 1, val->count - 1);
+                lval_del(val);
+
+                return result;
+            }
+        }
+
         //Evaluate children
-        for(int i = 0; i < val->count; i++) {
+        for(int i = val->count > 1; i < val->count; i++) {
             val->cell[i] = lval_eval(env, val->cell[i]);
         }
 
@@ -1082,69 +6917,253 @@ void add_history(char* unused) {}
         lval* result = lval_call(env, first, val);
         lval_del(first);
 
-        return result;
+        return result;
+    }
+
+    //Evaluate expr without consuming it, for code that's kept
+    lval* lval_eval_ref(lenv* env, lval* expr) {
+        lstats.evals++;
+
+        if(expr->type == LVAL_SYM)
+            return lenv_get(env, expr);
+
+        if(expr->type == LVAL_SEXPR)
+            return lval_eval_sexpr_ref(env, expr);
+
+        return lval_cpy(expr);
+    }
+
+    //Evaluate the cells of expr as an S-Expression without consuming them,
+    //as lval_eval_sexpr would. A lambda's body is evaluated this way, so
+    //only the values it computes are allocated, not a copy of the body.
+    lval* lval_eval_sexpr_ref(lenv* env, lval* expr) {
+        //Empty Expression
+        if(expr->count == 0)
+            return lval_sexpr();
+
+        lval* first = lval_eval_ref(env, expr->cell[0]);
+
+        //Special forms get their arguments unevaluated
+        lform form = expr->count > 1 ? lform_of(first) : NULL;
+
+        if(form) {
+            lstats.calls[lstats_builtin_slot(first->builtin)]++;
+            lval_del(first);
+
+            return form(env, expr->cell + 1, expr->count - 1);
+        }
+
+        //Single Expression
+        if(expr->count == 1)
+            return lval_eval(env, first);
+
+        //Evaluate the arguments into a list of their own
+        lval* args = lval_sexpr();
+        args->cell = malloc(sizeof(lval*) * (expr->count - 1));
+
+        for(int i = 1; i < expr->count; i++) {
+            args->cell[args->count++] = lval_eval_ref(env, expr->cell[i]);
+        }
+
+        //Error checking
+        if(first->type == LVAL_ERR) {
+            lval_del(args);
+            return first;
+        }
+
+        for(int i = 0; i < args->count; i++) {
+            if(args->cell[i]->type == LVAL_ERR) {
+                lval_del(first);
+                return lval_take(args, i);
+            }
+        }
+
+        if(first->type != LVAL_FUN) {
+            lval* err = lval_err("S-Expression starts with incorrect type. Got %s, Expexted %s", ltype_name(first->type), ltype_name(LVAL_FUN));
+            lval_del(first);
+            lval_del(args);
+
+            return err;
+        }
+
+        //Call builtin with operator
+        lval* result = lval_call(env, first, args);
+        lval_del(first);
+
+        return result;
+    }
+
+    //Prints an lval's sub-expressions
+    void lval_sink_expr(lsink* sink, lval* val, char open, char close) {
+        lsink_putc(sink, open);
+
+        for(int i = 0; i < val->count; i++) {
+            //Print val contained within
+            lval_sink(sink, val->cell[i]);
+
+            //Don't print trailing space if last
+            if(i != (val->count - 1)) {
+                lsink_putc(sink, ' ');
+            }
+        }
+
+        lsink_putc(sink, close);
+    }
+
+    //Prints the {key value} entries under a trie node, returns updated first flag
+    int lhamt_sink(lsink* sink, lhamt* node, int first) {
+        if(!node)
+            return first;
+
+        for(int i = 0; i < node->count; i++) {
+            if(!node->leaf) {
+                first = lhamt_sink(sink, node->children[i], first);
+                continue;
+            }
+
+            if(!first) lsink_putc(sink, ' ');
+            first = 0;
+
+            lsink_putc(sink, '{');
+            lval_sink(sink, node->keys[i]);
+            lsink_putc(sink, ' ');
+            lval_sink(sink, node->vals[i]);
+            lsink_putc(sink, '}');
+        }
+
+        return first;
     }
 
-    //Prints an lval's sub-expressions
-    void lval_expr_print(lval* val, char open, char close) {
-        putchar(open);
+    //Prints a string between " chars, escaping it a run at a time
+    void lval_sink_str(lsink* sink, lval* val) {
+        long start = 0;
 
-        for(int i = 0; i < val->count; i++) {
-            //Print val contained within
-            lval_print(val->cell[i]);
+        lsink_putc(sink, '"');
 
-            //Don't print trailing space if last
-            if(i != (val->count - 1)) {
-                putchar(' ');
+        for(long i = 0; i < val->len; i++) {
+            char* escaped = lval_escape(val->str[i]);
+
+            if(escaped) {
+                lsink_write(sink, val->str + start, i - start);
+                lsink_puts(sink, escaped);
+                start = i + 1;
             }
         }
 
-        putchar(close);
+        lsink_write(sink, val->str + start, val->len - start);
+        lsink_putc(sink, '"');
     }
 
-    //Prints an lval
-    void lval_print(lval* val) {
+    //Prints an lval into a sink
+    void lval_sink(lsink* sink, lval* val) {
         switch(val->type) {
             //If lval is type LVAL_NUM, print it and break
             case LVAL_NUM:
-                printf("%li", val->num);
+                lsink_num(sink, val->num);
                 break;
 
             //If lval is type LVAL_ERR, check it's error type and print it
             case LVAL_ERR:
-                printf("Error: %s", val->err);
+                lsink_puts(sink, "Error: ");
+                lsink_write(sink, val->err, val->len);
                 break;
 
             case LVAL_SYM:
-                printf("%s", val->symbol);
+                lsink_write(sink, val->symbol, val->len);
                 break;
 
             case LVAL_SEXPR:
-                lval_expr_print(val, '(', ')');
+                lval_sink_expr(sink, val, '(', ')');
                 break;
 
             case LVAL_QEXPR:
-                lval_expr_print(val, '{', '}');
+                lval_sink_expr(sink, val, '{', '}');
                 break;
 
             case LVAL_FUN:
                 if(val->builtin) {
-                    printf("<function>");
+                    lsink_puts(sink, "<function>");
                 } else {
-                    printf("(\\ ");
-                    lval_print(val->formals);
-                    putchar(' ');
-                    lval_print(val->body);
-                    putchar(')');
+                    lsink_puts(sink, "(\\ ");
+                    lval_sink(sink, val->formals);
+                    lsink_putc(sink, ' ');
+                    lval_sink(sink, val->body);
+                    lsink_putc(sink, ')');
                 }
                 break;
 
             case LVAL_STR:
-                lval_print_str(val);
+                lval_sink_str(sink, val);
+                break;
+
+            case LVAL_HASH:
+                lsink_puts(sink, "#{");
+
+                for(int i = 0, first = 1; i < val->hash->cap; i++) {
+                    if(!val->hash->keys[i])
+                        continue;
+
+                    if(!first) lsink_putc(sink, ' ');
+                    first = 0;
+
+                    lsink_putc(sink, '{');
+                    lval_sink(sink, val->hash->keys[i]);
+                    lsink_putc(sink, ' ');
+                    lval_sink(sink, val->hash->vals[i]);
+                    lsink_putc(sink, '}');
+                }
+
+                lsink_putc(sink, '}');
+                break;
+
+            case LVAL_DICT:
+                lsink_puts(sink, "#dict{");
+                lhamt_sink(sink, val->dict, 1);
+                lsink_putc(sink, '}');
+                break;
+
+            case LVAL_THREAD:
+                lsink_puts(sink, "<thread>");
+                break;
+
+            case LVAL_FUTURE:
+                lsink_puts(sink, "<future>");
+                break;
+
+            case LVAL_ISOLATE:
+                lsink_puts(sink, "<isolate>");
+                break;
+
+            case LVAL_SEQ:
+                lsink_puts(sink, "<sequence>");
+                break;
+
+            case LVAL_FILE:
+                lsink_puts(sink, "<file>");
+                break;
+
+            case LVAL_VEC:
+                lsink_putc(sink, '[');
+
+                for(int i = 0; i < val->count; i++) {
+                    if(i) lsink_putc(sink, ' ');
+                    lsink_num(sink, val->data[i]);
+                }
+
+                lsink_putc(sink, ']');
                 break;
         }
     }
 
+    //Prints an lval to the output, through a buffer on the stack
+    void lval_print(lval* val) {
+        char data[LSINK_SIZE];
+        lsink sink = { data, 0, sizeof(data), LOUT };
+
+        lval_sink(&sink, val);
+        lsink_flush(&sink);
+    }
+
     char* ltype_name(int type) {
         switch(type) {
             case LVAL_FUN: return "Function";
@@ -1154,41 +7173,45 @@ void add_history(char* unused) {}
             case LVAL_SEXPR: return "S-Expression";
             case LVAL_QEXPR: return "Q-Expression";
             case LVAL_STR: return "String";
+            case LVAL_VEC: return "Vector";
+            case LVAL_HASH: return "Hash Map";
+            case LVAL_DICT: return "Dict";
+            case LVAL_THREAD: return "Thread";
+            case LVAL_FUTURE: return "Future";
+            case LVAL_ISOLATE: return "Isolate";
+            case LVAL_SEQ: return "Sequence";
+            case LVAL_FILE: return "File";
             default: return "Unknown";
         }
     }
 
     void lval_println(lval* val) {
-        lval_print(val);
-        putchar('\n');
-    }
-
-    void lval_print_str(lval* val) {
-        //Make a copy of the string
-        char* escaped = malloc(strlen(val->str) + 1);
-        strcpy(escaped, val->str);
-
-        //Pass through the escape function
-        escaped = mpcf_escape(escaped);
-
-        //Print it between " chars
-        printf("\"%s\"", escaped);
+        char data[LSINK_SIZE];
+        lsink sink = { data, 0, sizeof(data), LOUT };
 
-        //Free copied string
-        free(escaped);
+        lval_sink(&sink, val);
+        lsink_putc(&sink, '\n');
+        lsink_flush(&sink);
     }
 
     lval* lval_cpy(lval* vals) {
-        lval* result = malloc(sizeof(lval));
-        result->type = vals->type;
+        lval* result = lval_alloc(vals->type);
+
+        lstats.copies++;
+        lstats.copyBytes += sizeof(lval);
 
         switch(vals->type) {
             //Copy functions and numbers directly
             case LVAL_FUN:
+                //Copies of a memoized function share its cache
+                result->memo = vals->memo;
+                if(result->memo) LREF_INC(result->memo->refs);
+
                 if(vals->builtin) {
                     result->builtin = vals->builtin;
                 } else {
                     result->builtin = NULL;
+                    result->site = vals->site;
                     result->env = lenv_cpy(vals->env);
                     result->formals = lval_cpy(vals->formals);
                     result->body = lval_cpy(vals->body);
@@ -1198,37 +7221,586 @@ void add_history(char* unused) {}
                 result->num = vals->num;
                 break;
 
-            //Copy strings with malloc and strcpy
+            //Copy errors with malloc and memcpy
             case LVAL_ERR:
-                result->err = malloc(strlen(vals->err) + 1);
-                strcpy(result->err, vals->err);
+                lstats.copyBytes += vals->len + 1;
+                result->len = vals->len;
+                result->err = malloc(vals->len + 1);
+                memcpy(result->err, vals->err, vals->len + 1);
                 break;
 
+            //Symbols share their interned data
             case LVAL_SYM:
-                result->symbol = malloc(strlen(vals->symbol) + 1);
-                strcpy(result->symbol, vals->symbol);
+                result->len = vals->len;
+                result->symbol = vals->symbol;
+                result->name = vals->name;
                 break;
 
             //Copy expressions by copying each sub-expression
             case LVAL_SEXPR:
             case LVAL_QEXPR:
+                lstats.copyBytes += sizeof(lval*) * vals->count;
                 result->count = vals->count;
                 result->cell = malloc(sizeof(lval*) * result->count);
+                result->file = vals->file;
+                result->line = vals->line;
 
                 for(int i = 0; i < result->count; i++) {
                     result->cell[i] = lval_cpy(vals->cell[i]);
                 }
             break;
 
+            //Strings share their buffer
             case LVAL_STR:
-                result->str = malloc(strlen(vals->str) + 1);
-                strcpy(result->str, vals->str);
+                result->buf = vals->buf;
+                result->str = vals->str;
+                result->len = vals->len;
+                LREF_INC(result->buf->refs);
+                break;
+
+            case LVAL_VEC:
+                lstats.copyBytes += sizeof(long) * vals->count;
+                result->count = vals->count;
+                result->data = malloc(sizeof(long) * result->count);
+                memcpy(result->data, vals->data, sizeof(long) * result->count);
+                break;
+
+            //Maps share their table until one of them is changed
+            case LVAL_HASH:
+                result->hash = vals->hash;
+                LREF_INC(result->hash->refs);
+                break;
+
+            //Dicts are immutable so copies just share the trie
+            case LVAL_DICT:
+                result->dict = vals->dict;
+                result->count = vals->count;
+                if(result->dict) LREF_INC(result->dict->refs);
+                break;
+
+            //Thread handles share the thread
+            case LVAL_THREAD:
+                result->thread = vals->thread;
+                LREF_INC(result->thread->refs);
+                break;
+
+            case LVAL_FUTURE:
+                result->future = vals->future;
+                LREF_INC(result->future->refs);
+                break;
+
+            case LVAL_ISOLATE:
+                result->isolate = vals->isolate;
+                LREF_INC(result->isolate->refs);
+                break;
+
+            case LVAL_SEQ:
+                result->seq = vals->seq;
+                LREF_INC(result->seq->refs);
+                break;
+
+            case LVAL_FILE:
+                result->stream = vals->stream;
+                LREF_INC(result->stream->refs);
                 break;
         }
 
         return result;
     }
 
+/* Batch Mode */
+    //--batch evaluates each file on one of a set of worker threads, in its
+    //own copy of the global env as it stands once the stdlib is loaded.
+    //Output is captured per file and written out in file order, with the
+    //status of each file on stderr. Output from threads and isolates a
+    //file starts isn't captured.
+    typedef struct {
+        char* path;
+        char* output;
+        size_t size;
+        long errors;
+        int done;
+    } lbatch_job;
+
+    typedef struct {
+        lenv* base;
+        lbatch_job* jobs;
+        int count;
+        int next;
+
+        pthread_mutex_t lock;
+        pthread_cond_t finished;
+    } lbatch;
+
+    void lbatch_run(lbatch* batch, lbatch_job* job) {
+        lenv* env = lenv_cpy(batch->base);
+        env->lock = malloc(sizeof(pthread_rwlock_t));
+        pthread_rwlock_init(env->lock, NULL);
+
+        FILE* out = open_memstream(&job->output, &job->size);
+        lout = out;
+        lload_errors = 0;
+
+        lval* result = builtin_load(env, lval_add(lval_sexpr(), lval_str(job->path)));
+
+        if(result->type == LVAL_ERR) {
+            lval_println(result);
+            lload_errors++;
+        }
+
+        lval_del(result);
+
+        job->errors = lload_errors;
+        lout = NULL;
+        fclose(out);
+
+        //Threads the file started may still be using the env
+        if(!__atomic_load_n(&lthread_running, __ATOMIC_ACQUIRE)) {
+            pthread_rwlock_destroy(env->lock);
+            free(env->lock);
+            lenv_del(env);
+        }
+    }
+
+    void* lbatch_worker(void* arg) {
+        lbatch* batch = arg;
+        int i;
+
+        while((i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED)) < batch->count) {
+            lbatch_run(batch, &batch->jobs[i]);
+
+            pthread_mutex_lock(&batch->lock);
+            batch->jobs[i].done = 1;
+            pthread_cond_broadcast(&batch->finished);
+            pthread_mutex_unlock(&batch->lock);
+        }
+
+        lstats_flush();
+        lheap_drain();
+
+        return NULL;
+    }
+
+    //Run every file on threads workers, returning how many had errors
+    int lbatch_main(lenv* base, char** paths, int count, int threads) {
+        lbatch batch;
+
+        batch.base = base;
+        batch.jobs = calloc(count, sizeof(lbatch_job));
+        batch.count = count;
+        batch.next = 0;
+        pthread_mutex_init(&batch.lock, NULL);
+        pthread_cond_init(&batch.finished, NULL);
+
+        for(int i = 0; i < count; i++) {
+            batch.jobs[i].path = paths[i];
+        }
+
+        if(threads > count)
+            threads = count;
+
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setstacksize(&attr, LTHREAD_STACK);
+
+        pthread_t* workers = malloc(sizeof(pthread_t) * threads);
+        int started = 0;
+
+        while(started < threads && pthread_create(&workers[started], &attr, lbatch_worker, &batch) == 0) {
+            started++;
+        }
+
+        pthread_attr_destroy(&attr);
+
+        //Without any workers the main thread does the work
+        if(!started)
+            lbatch_worker(&batch);
+
+        int failed = 0;
+
+        for(int i = 0; i < count; i++) {
+            lbatch_job* job = &batch.jobs[i];
+
+            pthread_mutex_lock(&batch.lock);
+
+            while(!job->done) {
+                pthread_cond_wait(&batch.finished, &batch.lock);
+            }
+
+            pthread_mutex_unlock(&batch.lock);
+
+            printf("==> %s <==\n", job->path);
+            fwrite(job->output, 1, job->size, stdout);
+            fflush(stdout);
+
+            if(job->errors) {
+                fprintf(stderr, "%s: %li error%s\n", job->path, job->errors, job->errors == 1 ? "" : "s");
+                failed++;
+            } else {
+                fprintf(stderr, "%s: ok\n", job->path);
+            }
+
+            free(job->output);
+        }
+
+        for(int i = 0; i < started; i++) {
+            pthread_join(workers[i], NULL);
+        }
+
+        free(workers);
+        free(batch.jobs);
+        pthread_mutex_destroy(&batch.lock);
+        pthread_cond_destroy(&batch.finished);
+
+        return failed;
+    }
+
+/* Server Mode */
+    //--serve builds the grammar and global env once, then forks workers
+    //that share them copy-on-write. Each worker accepts connections on a
+    //Unix socket, reads a script until the client shuts down its side,
+    //evaluates it in a copy of the global env and writes back the output.
+    volatile sig_atomic_t lserve_stop = 0;
+
+    void lserve_signal(int sig) {
+        lserve_stop = 1;
+    }
+
+    //Read everything the client sends into a string
+    char* lserve_read(int fd) {
+        size_t cap = 4096;
+        size_t len = 0;
+        char* buf = malloc(cap);
+        ssize_t n;
+
+        while((n = read(fd, buf + len, cap - len - 1)) != 0) {
+            if(n < 0) {
+                if(errno == EINTR)
+                    continue;
+
+                free(buf);
+                return NULL;
+            }
+
+            len += n;
+
+            if(len + 1 == cap) {
+                cap *= 2;
+                buf = realloc(buf, cap);
+            }
+        }
+
+        buf[len] = '\0';
+
+        return buf;
+    }
+
+    //Evaluate one script, writing its output and errors to the connection
+    void lserve_request(lenv* base, int fd) {
+        char* script = lserve_read(fd);
+        FILE* out = fdopen(fd, "w");
+
+        if(!script || !out) {
+            free(script);
+            if(out) fclose(out); else close(fd);
+            return;
+        }
+
+        lout = out;
+
+        mpc_result_t result;
+
+        if(mpc_parse("<socket>", script, Lispy, &result)) {
+            lenv* env = lenv_cpy(base);
+            env->lock = &lenv_lock;
+
+            char* file = lval_read_file;
+            lval_read_file = "<socket>";
+            lval* expr = lval_read(result.output);
+            lval_read_file = file;
+            mpc_ast_delete(result.output);
+
+            while(expr->count) {
+                lval* x = lval_eval(env, lval_pop(expr, 0));
+
+                if(x->type == LVAL_ERR)
+                    lval_println(x);
+
+                lval_del(x);
+            }
+
+            lval_del(expr);
+
+            //Threads the script started may still be using the env
+            if(!__atomic_load_n(&lthread_running, __ATOMIC_ACQUIRE))
+                lenv_del(env);
+        } else {
+            char* err_msg = mpc_err_string(result.error);
+            fputs(err_msg, out);
+            free(err_msg);
+            mpc_err_delete(result.error);
+        }
+
+        lout = NULL;
+        fclose(out);
+        free(script);
+    }
+
+    void lserve_worker(lenv* base, int sock) {
+        //A client hanging up early shouldn't take the worker with it
+        signal(SIGPIPE, SIG_IGN);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+
+        while(1) {
+            int fd = accept(sock, NULL, NULL);
+
+            if(fd < 0) {
+                if(errno == EINTR || errno == ECONNABORTED)
+                    continue;
+
+                perror("accept");
+                _exit(1);
+            }
+
+            lserve_request(base, fd);
+        }
+    }
+
+    //Listen on path with workers processes until interrupted
+    int lserve_main(lenv* base, char* path, int workers) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+
+        if(strlen(path) >= sizeof(addr.sun_path)) {
+            fprintf(stderr, "%s: socket path too long\n", path);
+            return 1;
+        }
+
+        strcpy(addr.sun_path, path);
+
+        int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+
+        if(sock < 0) {
+            perror("socket");
+            return 1;
+        }
+
+        unlink(path);
+
+        if(bind(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(sock, SOMAXCONN) != 0) {
+            perror(path);
+            close(sock);
+            return 1;
+        }
+
+        //No SA_RESTART, so waitpid returns when asked to stop
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = lserve_signal;
+        sigaction(SIGINT, &action, NULL);
+        sigaction(SIGTERM, &action, NULL);
+
+        fprintf(stderr, "listening on %s with %i worker%s\n", path, workers, workers == 1 ? "" : "s");
+        fflush(stdout);
+
+        pid_t* pids = calloc(workers, sizeof(pid_t));
+        int failed = 0;
+
+        while(!lserve_stop && !failed) {
+            //Start any worker that isn't running, replacing ones that died
+            for(int i = 0; i < workers; i++) {
+                if(pids[i])
+                    continue;
+
+                pid_t pid = fork();
+
+                if(pid == 0)
+                    lserve_worker(base, sock);
+
+                if(pid < 0) {
+                    perror("fork");
+                    failed = 1;
+                    break;
+                }
+
+                pids[i] = pid;
+            }
+
+            int status;
+            pid_t pid = waitpid(-1, &status, 0);
+
+            for(int i = 0; pid > 0 && i < workers; i++) {
+                if(pids[i] != pid)
+                    continue;
+
+                if(WIFSIGNALED(status))
+                    fprintf(stderr, "worker %i killed by signal %i, restarting\n", (int)pid, WTERMSIG(status));
+
+                pids[i] = 0;
+            }
+        }
+
+        for(int i = 0; i < workers; i++) {
+            if(pids[i])
+                kill(pids[i], SIGTERM);
+        }
+
+        for(int i = 0; i < workers; i++) {
+            if(pids[i])
+                waitpid(pids[i], NULL, 0);
+        }
+
+        free(pids);
+        close(sock);
+        unlink(path);
+
+        return failed;
+    }
+
+/* Pipe Mode */
+    //--pipe evaluates forms from stdin without the line editor, printing
+    //each result that isn't empty. Input is read in large chunks and each
+    //run of lines that closes every form it opens is parsed on its own,
+    //since mpc slows down on long inputs. Output goes through a large
+    //stdout buffer.
+    #define LPIPE_CHUNK 65536
+    #define LPIPE_OUTPUT (1 << 20)
+
+    typedef struct {
+        size_t pos;
+        int depth;
+        int string;
+        int escape;
+        int comment;
+    } lpipe_scan;
+
+    //Scan on from scan->pos, returning the end of the next complete line
+    //or 0 if there isn't one before len
+    size_t lpipe_next(lpipe_scan* scan, char* buf, size_t len) {
+        while(scan->pos < len) {
+            char c = buf[scan->pos++];
+
+            if(scan->comment) {
+                if(c == '\n')
+                    scan->comment = 0;
+            } else if(scan->string) {
+                if(scan->escape)
+                    scan->escape = 0;
+                else if(c == '\\')
+                    scan->escape = 1;
+                else if(c == '"')
+                    scan->string = 0;
+            } else if(c == '"') {
+                scan->string = 1;
+            } else if(c == ';') {
+                scan->comment = 1;
+            } else if(c == '(' || c == '{') {
+                scan->depth++;
+            } else if(c == ')' || c == '}') {
+                //A stray close is left for the parser to report
+                if(scan->depth > 0)
+                    scan->depth--;
+            }
+
+            if(c == '\n' && !scan->depth && !scan->string)
+                return scan->pos;
+        }
+
+        return 0;
+    }
+
+    //Evaluate the forms in a NUL terminated piece of input
+    long lpipe_eval(lenv* env, char* input) {
+        mpc_result_t result;
+        long errors = 0;
+
+        if(!mpc_parse("<stdin>", input, Lispy, &result)) {
+            fflush(stdout);
+            mpc_err_print_to(result.error, stderr);
+            mpc_err_delete(result.error);
+            return 1;
+        }
+
+        lval* expr = lval_read(result.output);
+        mpc_ast_delete(result.output);
+
+        while(expr->count) {
+            lval* x = lval_eval(env, lval_pop(expr, 0));
+
+            if(x->type == LVAL_ERR)
+                errors++;
+
+            //Skip the empty results of print, def and friends
+            if(x->type != LVAL_SEXPR || x->count)
+                lval_println(x);
+
+            lval_del(x);
+        }
+
+        lval_del(expr);
+
+        return errors;
+    }
+
+    //Read and evaluate stdin to the end, returning the number of errors
+    long lpipe_main(lenv* env) {
+        setvbuf(stdout, NULL, _IOFBF, LPIPE_OUTPUT);
+
+        lpipe_scan scan = { 0, 0, 0, 0, 0 };
+        size_t cap = LPIPE_CHUNK + 1;
+        size_t len = 0;
+        char* buf = malloc(cap);
+        long errors = 0;
+        ssize_t n;
+
+        while((n = read(STDIN_FILENO, buf + len, cap - len - 1)) != 0) {
+            if(n < 0) {
+                if(errno == EINTR)
+                    continue;
+
+                perror("stdin");
+                errors++;
+                break;
+            }
+
+            len += n;
+
+            size_t start = 0;
+            size_t end;
+
+            while((end = lpipe_next(&scan, buf, len))) {
+                char c = buf[end];
+                buf[end] = '\0';
+                errors += lpipe_eval(env, buf + start);
+                buf[end] = c;
+                start = end;
+            }
+
+            //Keep the unfinished tail, growing for a form longer than the buffer
+            memmove(buf, buf + start, len - start);
+            len -= start;
+            scan.pos -= start;
+
+            if(len + LPIPE_CHUNK + 1 > cap) {
+                cap = len + LPIPE_CHUNK + 1;
+                buf = realloc(buf, cap);
+            }
+        }
+
+        //Whatever is left has no trailing newline, or is unbalanced
+        buf[len] = '\0';
+
+        if(strspn(buf, " \t\r\n") != len)
+            errors += lpipe_eval(env, buf);
+
+        free(buf);
+        fflush(stdout);
+
+        return errors;
+    }
+
 /* Main */
 int main(int argc, char** argv) {
     /* Create some parsers */
@@ -1257,11 +7829,51 @@ int main(int argc, char** argv) {
         Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy
     );
 
+    /* Handle options, any other argument is a file to load */
+    int stats = 0;
+    int batch = 0;
+    char* serve = NULL;
+    int pipeMode = 0;
+    int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    char** files = malloc(sizeof(char*) * argc);
+    int fileCount = 0;
+
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--stats") == 0) {
+            stats = 1;
+        } else if(strcmp(argv[i], "--optimize") == 0) {
+            lopt_enabled = 1;
+        } else if(strcmp(argv[i], "--pipe") == 0) {
+            pipeMode = 1;
+        } else if(strcmp(argv[i], "--batch") == 0) {
+            batch = 1;
+        } else if(strncmp(argv[i], "--serve", 7) == 0) {
+            serve = argv[i][7] == '=' ? argv[i] + 8 : "lispy.sock";
+        } else if(strncmp(argv[i], "-j", 2) == 0) {
+            //Either -jN or -j N
+            char* count = argv[i][2] ? argv[i] + 2 : (i + 1 < argc) ? argv[++i] : "1";
+            jobs = atoi(count) > 0 ? atoi(count) : 1;
+        } else if(strncmp(argv[i], "--profile", 9) == 0) {
+            if(argv[i][9] == '=')
+                lprof_path = argv[i] + 10;
+
+            lprof_start();
+        } else if(strncmp(argv[i], "--", 2) != 0) {
+            files[fileCount++] = argv[i];
+        }
+    }
+
     /* Print Version and Exit info */
-    puts("Lispy Version 0.0.0.0.1");
-    puts("Press Ctrl+C to Exit\n\n");
+    if(!batch && !serve && !pipeMode) {
+        puts("Lispy Version 0.0.0.0.1");
+        puts("Press Ctrl+C to Exit\n\n");
+    }
+
+    /* Select SIMD kernels for this CPU */
+    lvec_init();
 
     lenv* env = lenv_new();
+    env->lock = &lenv_lock;
     lenv_add_builtins(env);
 
    /* Set up stdlib */
@@ -1280,11 +7892,16 @@ int main(int argc, char** argv) {
         mpc_err_delete(r.error);
     }
 
-    if(argc >= 2) {
-        //Loop over each supplied filename (starting from 1)
-        for(int i = 1; i < argc; i++) {
+    /* Batch mode evaluates the files concurrently and skips the REPL */
+    int failed = 0;
+
+    if(batch) {
+        failed = lbatch_main(env, files, fileCount, jobs);
+    } else {
+        //Loop over each supplied filename
+        for(int i = 0; i < fileCount; i++) {
             //Argument list with a single arg, the filename
-            lval* args = lval_add(lval_sexpr(), lval_str(argv[i]));
+            lval* args = lval_add(lval_sexpr(), lval_str(files[i]));
 
             //Pass to builtin_load and get the result
             lval* result = builtin_load(env, args);
@@ -1297,11 +7914,25 @@ int main(int argc, char** argv) {
         }
     }
 
+    free(files);
+
+    /* Server mode serves requests from the loaded env until interrupted */
+    if(serve)
+        failed = lserve_main(env, serve, jobs);
+
+    /* Pipe mode evaluates stdin in place of the REPL */
+    if(pipeMode)
+        failed = lpipe_main(env) > 0;
+
     /* Main interpreter loop */
-    while(1) {
+    while(!batch && !serve && !pipeMode) {
         /* Output the prompt and get input - using editline for *nix */
         char* input = readline("danLISP>> ");
 
+        /* Stop at end of input */
+        if(!input)
+            break;
+
         /* Add input to history */
         add_history(input);
 
@@ -1328,7 +7959,25 @@ int main(int argc, char** argv) {
         free(input);
     }
 
+    /* Threads still running may be using the env, the parsers, and the
+       builtin and profiler tables the reports read, so leave those to exit */
+    if(__atomic_load_n(&lthread_running, __ATOMIC_ACQUIRE) || __atomic_load_n(&lisolate_running, __ATOMIC_ACQUIRE)) {
+        if(stats || lprof_enabled)
+            fprintf(stderr, "Threads are still running, so no stats or profile are reported\n");
+
+        //Exit from here, where the env is still in scope and so isn't
+        //counted as leaked
+        exit(failed ? 1 : 0);
+    }
+
     lenv_del(env);
+    lheap_drain();
+
+    /* Write out the profile if one was taken */
+    lprof_report();
+
+    if(stats)
+        lstats_report();
 
     /* Clean up the parsers */
     mpc_cleanup(
@@ -1343,5 +7992,6 @@ int main(int argc, char** argv) {
         Lispy
     );
 
-    return 0;
+    /* Fail if any batch file or piped form had errors, or the server could not start */
+    return failed ? 1 : 0;
 }